@@ -0,0 +1,277 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+  Headless batch runner. Loads a model once, then runs a set of
+  variants of it, each variant being a line of name=value assignments
+  to the initial values of variables, eg
+
+     minsky-batch -j 8 -t 100 -o results model.mky variants.txt
+
+  writes results/model-<n>.dat for the nth variant listed in
+  variants.txt. Lines beginning with # are ignored.
+
+  Each variant is run in a forked worker process, which inherits the
+  loaded model and its compiled equations from the parent.
+*/
+
+#include "minsky.h"
+#include "minsky_epilogue.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace minsky;
+using namespace std;
+
+namespace minsky
+{
+  Minsky& minsky() {
+    static Minsky m;
+    return m;
+  }
+  // GUI callback needed only to solve linkage problems
+  void doOneEvent(bool idleTasksOnly) {}
+  // not used, but needed for the linker
+  LocalMinsky::LocalMinsky(Minsky& m) {}
+  LocalMinsky::~LocalMinsky() {}
+}
+
+namespace
+{
+  typedef vector<pair<string,string>> Variant;
+
+  vector<Variant> readVariants(istream& input)
+  {
+    vector<Variant> r;
+    string line;
+    while (getline(input, line))
+      {
+        istringstream is(line);
+        string assignment;
+        Variant variant;
+        while (is>>assignment)
+          {
+            if (assignment[0]=='#') break;
+            auto eq=assignment.find('=');
+            if (eq==string::npos || eq==0)
+              throw runtime_error("invalid assignment "+assignment);
+            variant.emplace_back(assignment.substr(0,eq), assignment.substr(eq+1));
+          }
+        if (!variant.empty())
+          r.push_back(move(variant));
+      }
+    return r;
+  }
+
+  /// run the loaded model with \a variant applied, logging all
+  /// variables to \a output
+  void run(const Variant& variant, double tmax, const string& output)
+  {
+    auto& m=minsky();
+    for (auto& i: variant)
+      {
+        // unqualified names refer to global variables
+        auto name=i.first.find(':')==string::npos? ":"+i.first: i.first;
+        auto v=m.variableValues.find(VariableValue::valueId(name));
+        if (v==m.variableValues.end())
+          throw runtime_error("unknown variable "+i.first);
+        v->second->init=i.second;
+      }
+    // reinitialise values in place, so that the equations compiled
+    // when the model was loaded remain valid
+    for (auto& v: m.variableValues)
+      v.second->reset(m.variableValues);
+    EvalOpBase::t=m.t=m.t0;
+    m.RungeKutta::reset();
+    m.evalEquations();
+
+    m.logVarList.clear();
+    for (auto& v: m.variableValues)
+      if (!v.second->temp())
+        m.logVarList.insert(v.first);
+    m.openLogFile(output);
+    m.running=true;
+    vector<EvalOpBase*> equations;
+    for (auto& e: m.equations) equations.push_back(e.get());
+    while (m.t<tmax)
+      m.step();
+    m.closeLogFile();
+    // variants reuse the equations compiled when the model was
+    // loaded, which a reset during the run would have reconstructed
+    if (m.equations.size()!=equations.size() ||
+        !equal(equations.begin(), equations.end(), m.equations.begin(),
+               [](EvalOpBase* x, const EvalOpPtr& y){return x==y.get();}))
+      throw runtime_error("equations were reconstructed during the run");
+  }
+}
+
+int main(int argc, char* argv[])
+{
+  namespace po=boost::program_options;
+  unsigned jobs=1;
+  double tmax=0;
+  string outputDir=".";
+  vector<string> files;
+  po::options_description options("options");
+  options.add_options()
+    ("jobs,j", po::value(&jobs), "number of variants run in parallel (ignored on Windows)")
+    ("tmax,t", po::value(&tmax), "time to run each variant until (default model's tmax)")
+    ("output,o", po::value(&outputDir), "directory results are written to");
+  po::options_description allOptions;
+  allOptions.add(options).add_options()
+    ("files", po::value(&files));
+  po::positional_options_description positional;
+  positional.add("files", -1);
+
+  // parallel runs require fork(), so variants are run sequentially on Windows
+#ifndef _WIN32
+  jobs=max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+  try
+    {
+      po::variables_map vm;
+      po::store(po::command_line_parser(argc, argv).options(allOptions).positional(positional).run(), vm);
+      po::notify(vm);
+    }
+  catch (const std::exception& ex)
+    {
+      cerr << ex.what() << endl;
+      files.clear();
+    }
+  if (files.size()!=2)
+    {
+      cerr << "usage: "<<argv[0]<<" [options] model.mky variants"<<endl<<options;
+      return 1;
+    }
+  jobs=max(1u, jobs);
+  auto& modelFile=files[0];
+  auto& variantsFile=files[1];
+
+  vector<Variant> variants;
+  string stem;
+  try
+    {
+      ifstream variantFile(variantsFile);
+      if (!variantFile)
+        throw runtime_error("failed to open "+variantsFile);
+      variants=readVariants(variantFile);
+
+      minsky().load(modelFile);
+      // resetting whilst running clears the reset flag, so the first
+      // step of each variant does not reconstruct the equations
+      minsky().running=true;
+      minsky().reset();
+      if (tmax<=0) tmax=minsky().tmax;
+      if (!isfinite(tmax))
+        throw runtime_error("model has no finite tmax, please specify -t");
+      stem=boost::filesystem::path(modelFile).stem().string();
+      boost::filesystem::create_directories(outputDir);
+    }
+  catch (const std::exception& ex)
+    {
+      cerr << ex.what() << endl;
+      return 1;
+    }
+
+  auto outputName=[&](size_t i) {
+    return (boost::filesystem::path(outputDir)/(stem+"-"+to_string(i)+".dat")).string();
+  };
+
+  int failures=0;
+#ifndef _WIN32
+  if (jobs>1)
+    {
+      unsigned running=0;
+      auto waitForWorker=[&]() {
+        int status;
+        if (wait(&status)>0)
+          {
+            --running;
+            if (!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+              ++failures;
+          }
+      };
+      for (size_t i=0; i<variants.size(); ++i)
+        {
+          if (running>=jobs)
+            waitForWorker();
+          auto pid=fork();
+          if (pid<0)
+            {
+              perror("fork");
+              ++failures;
+              continue;
+            }
+          if (pid==0)
+            {
+              int status=0;
+              try
+                {
+                  run(variants[i], tmax, outputName(i));
+                }
+              catch (const std::exception& ex)
+                {
+                  cerr << "variant "<<i<<": "<<ex.what() << endl;
+                  status=1;
+                }
+              // skip destructors of the parent's objects
+              _exit(status);
+            }
+          ++running;
+        }
+      while (running>0)
+        waitForWorker();
+    }
+  else
+#endif
+    {
+      // run in process, restoring the model's initial values between runs
+      map<string,string> initialValues;
+      for (auto& v: minsky().variableValues)
+        initialValues[v.first]=v.second->init;
+      for (size_t i=0; i<variants.size(); ++i)
+        {
+          try
+            {
+              run(variants[i], tmax, outputName(i));
+            }
+          catch (const std::exception& ex)
+            {
+              cerr << "variant "<<i<<": "<<ex.what() << endl;
+              ++failures;
+            }
+          for (auto& v: minsky().variableValues)
+            v.second->init=initialValues[v.first];
+        }
+    }
+
+  if (failures)
+    cerr << failures << " of "<<variants.size()<<" variants failed"<<endl;
+  return failures>0;
+}
@@ -31,6 +31,7 @@ using namespace std;
 #include <boost/type_traits.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/token_functions.hpp>
+#include <unordered_map>
 
 typedef boost::escaped_list_separator<char> Parser;
 typedef boost::tokenizer<Parser> Tokenizer;
@@ -412,7 +413,7 @@ namespace minsky
     typedef vector<string> Key;
     map<Key,double> tmpData;
     map<Key,int> tmpCnt;
-    vector<map<string,size_t>> dimLabels(spec.dimensionCols.size());
+    vector<unordered_map<string,size_t>> dimLabels(spec.dimensionCols.size());
     bool tabularFormat=false;
     Hypercube hc;
     vector<string> horizontalLabels;
@@ -582,8 +583,9 @@ namespace minsky
                 assert(dimLabels.size()==hc.rank());
                 for (int j=hc.rank()-1; j>=0; --j)
                   {
-                    assert(dimLabels[j].count(i.first[j]));
-                    idx = (idx*dims[j]) + dimLabels[j][i.first[j]];
+                    auto label=dimLabels[j].find(i.first[j]);
+                    assert(label!=dimLabels[j].end());
+                    idx = (idx*dims[j]) + label->second;
                   }
                 v.tensorInit[idx]=i.second;  
               }
@@ -602,8 +604,9 @@ namespace minsky
                 assert(dimLabels.size()==dims.size());
                 for (int j=dims.size()-1; j>=0; --j)
                   {
-                    assert(dimLabels[j].count(i.first[j]));
-                    idx = (idx*dims[j]) + dimLabels[j][i.first[j]];
+                    auto label=dimLabels[j].find(i.first[j]);
+                    assert(label!=dimLabels[j].end());
+                    idx = (idx*dims[j]) + label->second;
                   }
                 if (!isnan(i.second))
                   indexValue.emplace(idx, i.second);
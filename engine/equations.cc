@@ -88,11 +88,13 @@ namespace MathDAG
         try
           {
             auto ec=make_shared<EvalCommon>();
-            TensorPtr rhs=tensorOpFactory.create(state,TensorsFromPort(ec));
+            TensorPtr rhs=tensorOpFactory.create(state,TensorsFromPort(ec,true));
             if (!rhs) return false;
             result->index(rhs->index());
             result->hypercube(rhs->hypercube());
-            ev.emplace_back(EvalOpPtr(new TensorEval(result, ec, rhs)));
+            auto tensorEval=new TensorEval(result, ec, rhs);
+            tensorEval->item=state;
+            ev.emplace_back(EvalOpPtr(tensorEval));
             return true;
           }
         catch(const FallBackToScalar&) {/* fall back to scalar processing */}
@@ -56,6 +56,11 @@ namespace minsky
     /// flowVars.
     void eval(double sv[], const double fv[]) const;
 
+    /// calls \a f(stockIdx, flowIdx) for each flow variable
+    /// contributing to a stock variable
+    template <class F> void forEachFlow(F f) const
+    {for (std::size_t i=0; i<sidx.size(); ++i) f(sidx[i], fidx[i]);}
+
     EvalGodley():  compatibility(false) {}
     /// if compatibility is true, then consttrainst between Godley
     /// tables is not applied, and shared columns are merely summed
@@ -37,6 +37,45 @@ using namespace boost::math;
 namespace minsky
 {
 
+  bool EvalOpBase::dependencies(size_t i, const std::function<void(bool,size_t)>& f) const
+  {
+    if (i<in1.size())
+      f(flow1, in1[i]);
+    if (i<in2.size())
+      for (auto& j: in2[i])
+        f(flow2, j.idx);
+    return true;
+  }
+
+  void ScalarEvalOp::evaluateArray(double r[], const double x1[], const double x2[], size_t n) const
+  {
+    for (size_t i=0; i<n; ++i)
+      r[i]=evaluate(x1[i], x2? x2[i]: 0);
+  }
+
+  bool ScalarEvalOp::contiguousOperands() const
+  {
+    auto n=in1.size();
+    if (n<2 || numArgs()<1) return false;
+    // a flow variable input partially overlapping the output would
+    // read results of the current operation
+    auto overlaps=[&](bool flow, size_t start) {
+      return flow && start!=size_t(out) && start<out+n && size_t(out)<start+n;
+    };
+    for (size_t i=1; i<n; ++i)
+      if (in1[i]!=in1[0]+i) return false;
+    if (overlaps(flow1, in1[0])) return false;
+    if (numArgs()>1)
+      {
+        if (in2.size()!=n) return false;
+        for (size_t i=0; i<n; ++i)
+          if (in2[i].size()!=1 || in2[i][0].weight!=1 || in2[i][0].idx!=in2[0][0].idx+i)
+            return false;
+        if (overlaps(flow2, in2[0][0].idx)) return false;
+      }
+    return true;
+  }
+  
   void ScalarEvalOp::eval(double fv[], size_t n, const double sv[])
   {
     assert(out>=0);
@@ -48,11 +87,22 @@ namespace minsky
         break;
       case 1:
         assert(out+in1.size()<=n);
+        if (useEvaluateArray())
+          {
+            evaluateArray(fv+out, (flow1? fv: sv)+in1[0], nullptr, in1.size());
+            break;
+          }
         for (unsigned i=0; i<in1.size(); ++i)
           fv[out+i]=evaluate(flow1? fv[in1[i]]: sv[in1[i]], 0);
         break;
       case 2:
         assert(out+in1.size()<=n);
+        if (useEvaluateArray())
+          {
+            evaluateArray(fv+out, (flow1? fv: sv)+in1[0],
+                          (flow2? fv: sv)+in2[0][0].idx, in1.size());
+            break;
+          }
         for (unsigned i=0; i<in1.size(); ++i)
           {
             double x2=0;
@@ -604,6 +654,19 @@ namespace minsky
   double EvalOp<OperationType::numOps>::d2(double x1, double x2) const
   {throw error("calling d2() on EvalOp<numOps> invalid");}
 
+  // defined after the evaluate() specialisations, so that these are
+  // called directly and can be inlined into the loop
+  template <OperationType::Type T>
+  void EvalOp<T>::evaluateArray(double r[], const double x1[], const double x2[], size_t n) const
+  {
+    if (x2)
+      for (size_t i=0; i<n; ++i)
+        r[i]=EvalOp<T>::evaluate(x1[i], x2[i]);
+    else
+      for (size_t i=0; i<n; ++i)
+        r[i]=EvalOp<T>::evaluate(x1[i], 0);
+  }
+
   namespace {OperationFactory<ScalarEvalOp, EvalOp, OperationType::sum-1> evalOpFactory;}
 
   ScalarEvalOp* ScalarEvalOp::create(Type op, const ItemPtr& state)
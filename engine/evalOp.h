@@ -29,6 +29,7 @@
 #include "polyPackBase.h"
 
 #include <vector>
+#include <functional>
 #include <cairo/cairo.h>
 
 #include <arrays.h>
@@ -101,6 +102,17 @@ namespace minsky
 
     /// set additional tensor operation related parameters
     virtual void setTensorParams(const VariableValue&,const OperationBase&) {}
+
+    /// range of flow variables [first, first+second) written by eval()
+    virtual std::pair<int,std::size_t> outputRange() const
+    {return {out, std::max(in1.size(), std::size_t(1))};}
+
+    /// structural dependencies of output element \a i, used for
+    /// Jacobian sparsity analysis. \a f(isFlowVar, idx) is called for
+    /// each variable element output \a i depends on.
+    /// @return false if the dependency structure is not known, in
+    /// which case output \a i may depend on any variable
+    virtual bool dependencies(std::size_t i, const std::function<void(bool,std::size_t)>& f) const;
   };
 
   /// Legacy EvalOp base interface
@@ -119,6 +131,21 @@ namespace minsky
  
     /// evaluate expression on given arguments, returning result
     virtual double evaluate(double in1=0, double in2=0) const=0;
+    /// evaluate expression elementwise over \a n contiguous arguments:
+    /// r[i]=evaluate(x1[i],x2[i]). \a x2 is null for single argument operations
+    virtual void evaluateArray(double r[], const double x1[], const double x2[], std::size_t n) const;
+    /// true if in1 (and in2 for binary operations) refer to
+    /// contiguous, unweighted ranges that do not partially overlap the
+    /// output, so that eval() can use evaluateArray()
+    bool contiguousOperands() const;
+    /// contiguousOperands(), cached on first use
+    bool useEvaluateArray() const {
+      if (m_useEvaluateArray<0) m_useEvaluateArray=contiguousOperands();
+      return m_useEvaluateArray;
+    }
+    /// discard the cached useEvaluateArray(). Call after changing
+    /// out, in1 or in2 of an operation that has been evaluated.
+    void invalidateEvaluateArray() {m_useEvaluateArray=-1;}
     /**
        @{
        derivatives with respect to 1st and second argument
@@ -126,6 +153,8 @@ namespace minsky
     virtual double d1(double x1=0, double x2=0) const=0;
     virtual double d2(double x1=0, double x2=0) const=0;
     /// @}
+  private:
+    mutable int m_useEvaluateArray=-1; ///< -1 if not yet determined
   };
   
   /// represents the operation when evaluating the equations
@@ -137,6 +166,7 @@ namespace minsky
       return OperationTypeInfo::numArguments<T>();
     }
     double evaluate(double in1=0, double in2=0) const override;
+    void evaluateArray(double r[], const double x1[], const double x2[], std::size_t n) const override;
     double d1(double x1=0, double x2=0) const override;
     double d2(double x1=0, double x2=0) const override;
   };
@@ -145,6 +175,8 @@ namespace minsky
   {
     double value;
     double evaluate(double in1=0, double in2=0) const override;
+    void evaluateArray(double r[], const double*, const double*, std::size_t n) const override
+    {for (std::size_t i=0; i<n; ++i) r[i]=value;}
  };
 
   struct EvalOpPtr: public classdesc::shared_ptr<EvalOpBase>, 
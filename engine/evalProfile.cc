@@ -0,0 +1,183 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "evalProfile.h"
+#include "minskyTensorOps.h"
+#include "operation.h"
+#include "variable.h"
+#include "minsky_epilogue.h"
+
+#include <algorithm>
+#include <map>
+#include <ostream>
+
+using namespace std;
+
+namespace minsky
+{
+  namespace
+  {
+    string label(const Item& item)
+    {
+      string r;
+      if (auto v=item.variableCast())
+        r="variable "+v->name();
+      else if (auto op=item.operationCast())
+        r=OperationType::typeName(op->type());
+      else
+        r=item.classType();
+      return r+" at ("+to_string(int(item.x()))+","+to_string(int(item.y()))+")";
+    }
+
+    string label(const EvalOpBase& op)
+    {
+      if (dynamic_cast<const TensorEval*>(&op))
+        return "internal tensor copy";
+      return "internal "+OperationType::typeName(op.type());
+    }
+
+    string csvQuote(const string& x)
+    {
+      string r="\"";
+      for (auto c: x)
+        {
+          if (c=='"') r+='"';
+          r+=c;
+        }
+      return r+'"';
+    }
+
+    string jsonQuote(const string& x)
+    {
+      string r="\"";
+      for (auto c: x)
+        switch (c)
+          {
+          case '"': r+="\\\""; break;
+          case '\\': r+="\\\\"; break;
+          case '\n': r+="\\n"; break;
+          default:
+            if (static_cast<unsigned char>(c)<0x20) r+=' ';
+            else r+=c;
+          }
+      return r+'"';
+    }
+  }
+
+  EvalProfile& EvalProfile::operator=(const EvalProfile& x)
+  {
+    if (this==&x) return *this;
+    vector<Entry> e;
+    vector<size_t> o;
+    {
+      boost::lock_guard<boost::mutex> lock(x.mutex);
+      e=x.entries;
+      o=x.entryOf;
+    }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    entries.swap(e);
+    entryOf.swap(o);
+    return *this;
+  }
+
+  void EvalProfile::compile(const EvalOpVector& equations)
+  {
+    vector<Entry> newEntries;
+    vector<size_t> newEntryOf;
+    map<const Item*, size_t> itemEntries;
+    map<string, size_t> internalEntries;
+    for (auto& e: equations)
+      {
+        ItemPtr item;
+        if (auto t=dynamic_cast<const TensorEval*>(e.get()))
+          item=t->item.lock();
+        else if (e)
+          item=e->state;
+
+        if (item)
+          {
+            auto i=itemEntries.emplace(item.get(), newEntries.size());
+            if (i.second)
+              newEntries.push_back(Entry{item, label(*item), {}});
+            newEntryOf.push_back(i.first->second);
+          }
+        else
+          {
+            auto l=e? label(*e): "internal";
+            auto i=internalEntries.emplace(l, newEntries.size());
+            if (i.second)
+              newEntries.push_back(Entry{{}, l, {}});
+            newEntryOf.push_back(i.first->second);
+          }
+      }
+    boost::lock_guard<boost::mutex> lock(mutex);
+    entries.swap(newEntries);
+    entryOf.swap(newEntryOf);
+  }
+
+  vector<EvalProfile::Entry> EvalProfile::sorted() const
+  {
+    vector<Entry> r;
+    {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      r=entries;
+    }
+    stable_sort(r.begin(), r.end(), [](const Entry& x, const Entry& y)
+                {return x.stats.totalTime>y.stats.totalTime;});
+    return r;
+  }
+
+  double EvalProfile::totalTime() const
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    double r=0;
+    for (auto& e: entries) r+=e.stats.totalTime;
+    return r;
+  }
+
+  void EvalProfile::exportCSV(ostream& o) const
+  {
+    auto entries=sorted();
+    double total=0;
+    for (auto& e: entries) total+=e.stats.totalTime;
+    o<<"item,calls,total time(s),mean time(s),max time(s),fraction\n";
+    for (auto& e: entries)
+      o<<csvQuote(e.label)<<","<<e.stats.count<<","<<e.stats.totalTime<<","
+       <<e.stats.meanTime()<<","<<e.stats.maxTime<<","
+       <<(total>0? e.stats.totalTime/total: 0)<<"\n";
+  }
+
+  void EvalProfile::exportJSON(ostream& o) const
+  {
+    auto entries=sorted();
+    double total=0;
+    for (auto& e: entries) total+=e.stats.totalTime;
+    o<<"[";
+    const char* sep="\n";
+    for (auto& e: entries)
+      {
+        o<<sep<<"{\"item\":"<<jsonQuote(e.label)<<",\"calls\":"<<e.stats.count
+         <<",\"totalTime\":"<<e.stats.totalTime<<",\"meanTime\":"<<e.stats.meanTime()
+         <<",\"maxTime\":"<<e.stats.maxTime
+         <<",\"fraction\":"<<(total>0? e.stats.totalTime/total: 0)<<"}";
+        sep=",\n";
+      }
+    o<<"\n]\n";
+  }
+}
@@ -0,0 +1,87 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALPROFILE_H
+#define EVALPROFILE_H
+#include "evalOp.h"
+#include "solverStats.h"
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /// Wall time and call counts of an EvalOpVector's evaluation,
+  /// attributed to the canvas items the operations were generated
+  /// from. Calls are recorded on the simulation thread whilst the GUI
+  /// thread reads the profile, so access is serialised.
+  class EvalProfile
+  {
+  public:
+    struct Entry
+    {
+      std::weak_ptr<Item> item; ///< null for internally generated operations
+      std::string label; ///< description of the item for reports
+      TimingStats stats;
+    };
+
+    EvalProfile() {}
+    EvalProfile(const EvalProfile& x) {*this=x;}
+    EvalProfile& operator=(const EvalProfile& x);
+
+    /// map each of \a equations onto the item it was generated
+    /// from. Called from reset(), not whilst stepping.
+    void compile(const EvalOpVector& equations);
+    void clear() {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      entries.clear(); entryOf.clear();
+    }
+    bool empty() const {return size()==0;}
+    /// number of equations profiled
+    std::size_t size() const {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      return entryOf.size();
+    }
+
+    /// add a call of duration \a seconds to equation \a i's item
+    void record(std::size_t i, double seconds) {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      if (i<entryOf.size())
+        entries[entryOf[i]].stats.record(seconds);
+    }
+
+    /// snapshot of the entries, sorted by decreasing total time
+    std::vector<Entry> sorted() const;
+    /// total time spent over all entries
+    double totalTime() const;
+    /// write a report sorted by decreasing total time
+    void exportCSV(std::ostream&) const;
+    void exportJSON(std::ostream&) const;
+
+  private:
+    mutable boost::mutex mutex;
+    std::vector<Entry> entries;
+    /// index into entries of each equation
+    std::vector<std::size_t> entryOf;
+  };
+}
+#endif
@@ -0,0 +1,198 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "evalSchedule.h"
+#include "minsky_epilogue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <boost/thread.hpp>
+
+using namespace std;
+
+namespace minsky
+{
+  void EvalSchedule::compile(const EvalOpVector& equations, size_t numFlowVars)
+  {
+    clear();
+    // level of the last operation writing or reading each flow variable
+    vector<int> lastWrite(numFlowVars, -1), lastRead(numFlowVars, -1);
+    // level of the last operation that may read any flow variable
+    int lastReadAny=-1, maxLevel=-1;
+    vector<size_t> inputs;
+
+    for (auto& e: equations)
+      {
+        if (!e) continue;
+        auto range=e->outputRange();
+        inputs.clear();
+        bool known=true;
+        for (size_t i=0; i<range.second; ++i)
+          known&=e->dependencies(i, [&](bool isFlow, size_t idx) {
+              if (isFlow && idx<numFlowVars) inputs.push_back(idx);
+            });
+
+        int level=lastReadAny+1;
+        if (known)
+          for (auto i: inputs)
+            level=max(level, lastWrite[i]+1);
+        else // may depend on anything evaluated previously
+          level=maxLevel+1;
+        if (range.first>=0)
+          for (size_t i=range.first; i<range.first+range.second && i<numFlowVars; ++i)
+            level=max(level, max(lastWrite[i], lastRead[i])+1);
+
+        if (known)
+          for (auto i: inputs)
+            lastRead[i]=max(lastRead[i], level);
+        else
+          lastReadAny=level;
+        if (range.first>=0)
+          for (size_t i=range.first; i<range.first+range.second && i<numFlowVars; ++i)
+            lastWrite[i]=level;
+        maxLevel=max(maxLevel, level);
+
+        if (size_t(level)>=levels.size()) levels.resize(level+1);
+        // only pure elementwise operations are evaluated concurrently
+        auto s=dynamic_cast<ScalarEvalOp*>(e.get());
+        if (s && s->type()!=OperationType::userFunction && s->type()!=OperationType::data)
+          levels[level].parallel.push_back(e.get());
+        else
+          levels[level].serial.push_back(e.get());
+        ops.push_back(e);
+      }
+  }
+
+  size_t EvalSchedule::width() const
+  {
+    size_t r=0;
+    for (auto& l: levels)
+      r=max(r, l.parallel.size());
+    return r;
+  }
+
+  /// pool of threads sharing out the operations of a level, by each
+  /// claiming the next unevaluated operation until none are left
+  struct EvalSchedule::ThreadPool
+  {
+    boost::mutex mutex;
+    boost::condition_variable start, done;
+    const vector<EvalOpBase*>* work=nullptr;
+    atomic<size_t> next{0};
+    double* fv=nullptr;
+    size_t n=0;
+    const double* sv=nullptr;
+    size_t generation=0;
+    unsigned active=0;
+    bool quit=false;
+    exception_ptr exception;
+    vector<boost::thread> threads;
+
+    ThreadPool(unsigned numThreads) {
+      for (unsigned i=0; i<numThreads; ++i)
+        threads.emplace_back([this]{worker();});
+    }
+    ~ThreadPool() {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        quit=true;
+      }
+      start.notify_all();
+      for (auto& t: threads) t.join();
+    }
+
+    void process() {
+      for (size_t i; (i=next++)<work->size(); )
+        try
+          {
+            (*work)[i]->eval(fv, n, sv);
+          }
+        catch (...)
+          {
+            boost::lock_guard<boost::mutex> lock(mutex);
+            if (!exception) exception=current_exception();
+          }
+    }
+
+    void worker() {
+      size_t lastGeneration=0;
+      boost::unique_lock<boost::mutex> lock(mutex);
+      for (;;)
+        {
+          start.wait(lock, [&]{return quit || generation!=lastGeneration;});
+          if (quit) return;
+          lastGeneration=generation;
+          lock.unlock();
+          process();
+          lock.lock();
+          if (--active==0) done.notify_all();
+        }
+    }
+
+    /// evaluate \a level, with the calling thread evaluating its
+    /// serial operations before helping with the parallel ones
+    void eval(const Level& level, double fv[], size_t n, const double sv[]) {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        work=&level.parallel;
+        next=0;
+        this->fv=fv; this->n=n; this->sv=sv;
+        active=threads.size();
+        ++generation;
+      }
+      start.notify_all();
+      try
+        {
+          for (auto op: level.serial)
+            op->eval(fv, n, sv);
+        }
+      catch (...)
+        {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          if (!exception) exception=current_exception();
+        }
+      process();
+      boost::unique_lock<boost::mutex> lock(mutex);
+      done.wait(lock, [this]{return active==0;});
+      if (exception)
+        {
+          auto e=exception;
+          exception=nullptr;
+          rethrow_exception(e);
+        }
+    }
+  };
+
+  void EvalSchedule::eval(double fv[], size_t n, const double sv[])
+  {
+    if (!pool)
+      pool=make_shared<ThreadPool>(max(1u, boost::thread::hardware_concurrency())-1);
+    for (auto& level: levels)
+      if (level.parallel.size()>1)
+        pool->eval(level, fv, n, sv);
+      else
+        {
+          for (auto op: level.serial)
+            op->eval(fv, n, sv);
+          for (auto op: level.parallel)
+            op->eval(fv, n, sv);
+        }
+  }
+}
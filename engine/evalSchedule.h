@@ -0,0 +1,63 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALSCHEDULE_H
+#define EVALSCHEDULE_H
+#include "evalOp.h"
+#include <memory>
+#include <vector>
+
+namespace minsky
+{
+  /// An EvalOpVector partitioned into levels of mutually independent
+  /// operations, each level being evaluated in parallel on a thread pool
+  class EvalSchedule
+  {
+  public:
+    struct Level
+    {
+      /// operations that may be evaluated concurrently with each other
+      std::vector<EvalOpBase*> parallel;
+      /// operations with shared state (eg tensor expressions, user
+      /// functions), evaluated in order on the calling thread
+      std::vector<EvalOpBase*> serial;
+    };
+
+    /// partition \a equations into levels, given \a numFlowVars flow variables
+    void compile(const EvalOpVector& equations, std::size_t numFlowVars);
+    void clear() {levels.clear(); ops.clear();}
+    bool empty() const {return levels.empty();}
+    const std::vector<Level>& getLevels() const {return levels;}
+    /// largest number of operations in a level that can be evaluated concurrently
+    std::size_t width() const;
+
+    /// evaluate the schedule, equivalent to calling eval() on each
+    /// equation in turn
+    void eval(double fv[], std::size_t n, const double sv[]);
+  private:
+    std::vector<Level> levels;
+    /// keeps the original operations alive for as long as the schedule refers to them
+    std::vector<EvalOpPtr> ops;
+    struct ThreadPool;
+    /// created on first evaluation, rather than at compile time, so
+    /// that a compiled model may be safely forked
+    std::shared_ptr<ThreadPool> pool;
+  };
+}
+#endif
@@ -0,0 +1,179 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "evalTape.h"
+#include "minsky_epilogue.h"
+
+#include <math.h>
+#include <limits>
+
+using namespace std;
+
+namespace minsky
+{
+  namespace
+  {
+    /// number of arguments of operations evaluated inline by the
+    /// tape, or -1 if the operation must be called via ScalarEvalOp
+    int inlineArgs(OperationType::Type t)
+    {
+      switch (t)
+        {
+        case OperationType::constant: case OperationType::time:
+        case OperationType::euler: case OperationType::pi:
+        case OperationType::zero: case OperationType::one:
+        case OperationType::inf:
+          return 0;
+        case OperationType::percent: case OperationType::copy:
+        case OperationType::sqrt: case OperationType::exp:
+        case OperationType::ln: case OperationType::sin:
+        case OperationType::cos: case OperationType::tan:
+        case OperationType::asin: case OperationType::acos:
+        case OperationType::atan: case OperationType::sinh:
+        case OperationType::cosh: case OperationType::tanh:
+        case OperationType::abs: case OperationType::floor:
+        case OperationType::frac: case OperationType::not_:
+          return 1;
+        case OperationType::add: case OperationType::subtract:
+        case OperationType::multiply: case OperationType::divide:
+        case OperationType::min: case OperationType::max:
+        case OperationType::and_: case OperationType::or_:
+        case OperationType::log: case OperationType::pow:
+        case OperationType::lt: case OperationType::le:
+        case OperationType::eq:
+          return 2;
+        default:
+          return -1;
+        }
+    }
+  }
+
+  void EvalTape::compile(const EvalOpVector& equations)
+  {
+    clear();
+    for (auto& e: equations)
+      {
+        if (!e) continue;
+        Instruction inst{callEval, 0, e->flow1, e->flow2, unsigned(e->out),
+                         0, 0, 0, 0, e.get()};
+        auto s=dynamic_cast<ScalarEvalOp*>(e.get());
+        if (s) s->invalidateEvaluateArray();
+        if (!s || e->out<0 || s->useEvaluateArray())
+          {
+            // not elementwise, or better evaluated over whole arrays
+            // by ScalarEvalOp::evaluateArray
+            ops.push_back(e);
+            instructions.push_back(inst);
+            continue;
+          }
+        inst.numArgs=s->numArgs();
+        inst.opcode=inlineArgs(s->type())==inst.numArgs? s->type(): callEvaluate;
+        if (auto c=dynamic_cast<ConstantEvalOp*>(s))
+          inst.value=c->value;
+        ops.push_back(e);
+
+        if (inst.numArgs==0)
+          {
+            instructions.push_back(inst);
+            continue;
+          }
+        for (size_t i=0; i<e->in1.size(); ++i, ++inst.out)
+          {
+            inst.in1=e->in1[i];
+            inst.supportBegin=inst.supportEnd=supports.size();
+            if (inst.numArgs>1 && i<e->in2.size())
+              {
+                supports.insert(supports.end(), e->in2[i].begin(), e->in2[i].end());
+                inst.supportEnd=supports.size();
+              }
+            instructions.push_back(inst);
+          }
+      }
+  }
+
+  size_t EvalTape::numFallbacks() const
+  {
+    size_t r=0;
+    for (auto& i: instructions)
+      if (i.opcode<0) ++r;
+    return r;
+  }
+
+  void EvalTape::eval(double fv[], size_t n, const double sv[]) const
+  {
+    for (auto& i: instructions)
+      {
+        if (i.opcode==callEval)
+          {
+            i.op->eval(fv, n, sv);
+            continue;
+          }
+        assert(i.out<n);
+        double x1=i.numArgs>0? (i.flow1? fv: sv)[i.in1]: 0, x2=0;
+        const double* v=i.flow2? fv: sv;
+        for (auto j=i.supportBegin; j<i.supportEnd; ++j)
+          x2+=supports[j].weight*v[supports[j].idx];
+        double& r=fv[i.out];
+        switch (i.opcode)
+          {
+          case OperationType::constant: r=i.value; break;
+          case OperationType::time: r=EvalOpBase::t; break;
+          case OperationType::euler: r=2.71828182845904523536028747135266249775724709369995; break;
+          case OperationType::pi: r=3.14159265358979323846264338327950288419716939937510; break;
+          case OperationType::zero: r=0; break;
+          case OperationType::one: r=1; break;
+          case OperationType::inf: r=numeric_limits<double>::max(); break;
+          case OperationType::percent: r=100.0*x1; break;
+          case OperationType::copy: r=x1; break;
+          case OperationType::sqrt: r=::sqrt(fabs(x1)); break;
+          case OperationType::exp: r=::exp(x1); break;
+          case OperationType::ln: r=::log(x1); break;
+          case OperationType::sin: r=::sin(x1); break;
+          case OperationType::cos: r=::cos(x1); break;
+          case OperationType::tan: r=::tan(x1); break;
+          case OperationType::asin: r=::asin(x1); break;
+          case OperationType::acos: r=::acos(x1); break;
+          case OperationType::atan: r=::atan(x1); break;
+          case OperationType::sinh: r=::sinh(x1); break;
+          case OperationType::cosh: r=::cosh(x1); break;
+          case OperationType::tanh: r=::tanh(x1); break;
+          case OperationType::abs: r=::fabs(x1); break;
+          case OperationType::floor: r=::floor(x1); break;
+          case OperationType::frac: r=x1-::floor(x1); break;
+          case OperationType::not_: r=x1<=0.5; break;
+          case OperationType::add: r=x1+x2; break;
+          case OperationType::subtract: r=x1-x2; break;
+          case OperationType::multiply: r=x1*x2; break;
+          case OperationType::divide: r=x1/x2; break;
+          case OperationType::min: r=std::min(x1,x2); break;
+          case OperationType::max: r=std::max(x1,x2); break;
+          case OperationType::and_: r=x1>0.5 && x2>0.5; break;
+          case OperationType::or_: r=x1>0.5 || x2>0.5; break;
+          case OperationType::log: r=::log(x1)/::log(x2); break;
+          case OperationType::pow: r=::pow(x1,x2); break;
+          case OperationType::lt: r=x1<x2; break;
+          case OperationType::le: r=x1<=x2; break;
+          case OperationType::eq: r=x1==x2; break;
+          default:
+            r=static_cast<const ScalarEvalOp*>(i.op)->evaluate(x1,x2);
+            break;
+          }
+      }
+  }
+}
@@ -0,0 +1,68 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef EVALTAPE_H
+#define EVALTAPE_H
+#include "evalOp.h"
+#include <vector>
+
+namespace minsky
+{
+  /// An EvalOpVector lowered into a flat sequence of elementwise
+  /// instructions, evaluated by a single switch loop rather than
+  /// virtual calls on each operation
+  class EvalTape
+  {
+  public:
+    /// opcodes for instructions not evaluated inline
+    enum {callEvaluate=-1, ///< call ScalarEvalOp::evaluate on \a op
+          callEval=-2 ///< call eval() on \a op (eg tensor or contiguous operations)
+    };
+    struct Instruction
+    {
+      /// OperationType evaluated inline, or one of the call codes above
+      int opcode;
+      int numArgs;
+      bool flow1, flow2;
+      unsigned out, in1;
+      /// range of interpolation supports for argument 2 [supportBegin, supportEnd)
+      unsigned supportBegin, supportEnd;
+      double value; ///< value of constant operations
+      EvalOpBase* op; ///< original operation, for those instructions not inlined
+    };
+
+    /// lower \a equations into this tape
+    void compile(const EvalOpVector& equations);
+    void clear() {instructions.clear(); supports.clear(); ops.clear();}
+    bool empty() const {return instructions.empty();}
+    std::size_t size() const {return instructions.size();}
+    /// number of instructions referring back to their original operation
+    std::size_t numFallbacks() const;
+
+    /// evaluate the tape, equivalent to calling eval() on each
+    /// equation in turn
+    void eval(double fv[], std::size_t n, const double sv[]) const;
+  private:
+    std::vector<Instruction> instructions;
+    std::vector<EvalOpBase::Support> supports;
+    /// keeps the original operations alive for as long as the tape refers to them
+    std::vector<EvalOpPtr> ops;
+  };
+}
+#endif
@@ -20,6 +20,7 @@
 #include <classdesc.h>
 #include "minskyTensorOps.h"
 #include "interpolateHypercube.h"
+#include "contraction.h"
 #include "minsky.h"
 #include "ravelWrap.h"
 #include "minsky_epilogue.h"
@@ -50,9 +51,20 @@ namespace minsky
   {
     size_t size() const override {return 1;}
     double operator[](size_t) const override {return EvalOpBase::t;}
-    Timestamp timestamp() const override {return {};}
+    // only a change of time invalidates caches depending on it
+    Timestamp timestamp() const override {
+      if (EvalOpBase::t!=stampedTime)
+        {
+          stampedTime=EvalOpBase::t;
+          stamp=newTimestamp();
+        }
+      return stamp;
+    }
     double dFlow(std::size_t, std::size_t) const override {return 0;}
     double dStock(std::size_t, std::size_t) const override {return 0;}
+  private:
+    mutable double stampedTime=nan("");
+    mutable Timestamp stamp=0;
   };
 
   // insert a setState virtual call for those that need
@@ -285,13 +297,28 @@ namespace minsky
   template <>
   struct GeneralTensorOp<OperationType::runningSum>: public civita::Scan
   {
-    GeneralTensorOp(): civita::Scan([](double& x,double y,size_t){x+=y;}) {}
+    GeneralTensorOp(): civita::Scan
+                       ([](double& x,double y,size_t){x+=y;},
+                        [](double& x,double y,double& err){
+                          if (!isfinite(x) || !isfinite(y)) return false;
+                          // rounding carried in x is exposed when
+                          // large values leave the window
+                          err+=fabs(x)*numeric_limits<double>::epsilon();
+                          x-=y;
+                          return err<=1e-10*fabs(x);
+                        }) {}
   };
 
   template <>
   struct GeneralTensorOp<OperationType::runningProduct>: public civita::Scan
   {
-    GeneralTensorOp(): civita::Scan([](double& x,double y,size_t){x*=y;}) {}
+    GeneralTensorOp(): civita::Scan
+                       ([](double& x,double y,size_t){x*=y;},
+                        [](double& x,double y,double&){
+                          if (!isfinite(x) || !isfinite(y) || y==0) return false;
+                          x/=y;
+                          return true;
+                        }) {}
   };
   
   template <>
@@ -299,13 +326,16 @@ namespace minsky
   {
     ssize_t delta=0;
     size_t innerStride=1, outerStride;
-    vector<size_t> argIndices;
+    /// for sparse arguments, positions in the argument's data of
+    /// each result's minuend and subtrahend
+    vector<pair<size_t,size_t>> argOffsets;
     void setArgument(const TensorPtr& a,const std::string& s,double d) override {
       civita::DimensionedArgCachedOp::setArgument(a,s,d);
       if (dimension>=rank() && rank()>1)
         throw error("axis name needs to be specified in difference operator");
       
       delta=d;
+      argOffsets.clear();
       // remove initial slice of hypercube
       auto hc=arg->hypercube();
       if (rank()==0) return;
@@ -331,18 +361,24 @@ namespace minsky
         }
       else
         outerStride=arg->hypercube().numElements();
-      auto idx=arg->index();
+      auto& idx=arg->index();
       set<size_t> idxSet(idx.begin(),idx.end()), newIdx;
-      for (auto& i: idx)
+      // maps argument hypercube indices into this's hypercube
+      MultiIndex argIdx(arg->hypercube());
+      argIdx.strides(hypercube().strides());
+      size_t pos=0;
+      for (auto i: idx)
         {
           // strip of any indices outside the output range
           auto t=ssize_t(i)-delta;
           if (t>=0 && t<ssize_t(arg->hypercube().numElements()) && idxSet.count(t) && sameSlice(t,i))
             {
-              argIndices.push_back(t);
-              newIdx.insert(hypercube().linealIndex(arg->hypercube().splitIndex(t)));
-              assert(argIndices.size()==newIdx.size());
+              argOffsets.emplace_back(pos, idx.linealOffset(t));
+              argIdx.seek(t);
+              newIdx.insert(argIdx.offset());
+              assert(argOffsets.size()==newIdx.size());
             }
+          ++pos;
         }
       cachedResult.index(Index(newIdx));
     }
@@ -354,36 +390,43 @@ namespace minsky
     
     void computeTensor() const override
     {
-      if (!argIndices.empty())
+      if (!size()) return; // lag spans the whole axis
+      if (!argOffsets.empty())
         {
-          assert(argIndices.size()==size());
+          assert(argOffsets.size()==size());
+          argValues.resize(arg->size());
+          arg->evaluate(argValues.data(), 0, argValues.size());
           size_t idx=0;
-          for (auto i: argIndices)
-            {
-              auto t=i+delta;
-              cachedResult[idx++]=arg->atHCIndex(t)-arg->atHCIndex(i);
-            }
+          for (auto& i: argOffsets)
+            cachedResult[idx++]=argValues[i.first]-argValues[i.second];
+        }
+      else
+        {
+          auto& values=denseArgument();
+          // walks this's hypercube, tracking the argument offset
+          MultiIndex idx(hypercube());
+          idx.strides(arg->hypercube().strides());
+          if (delta>=0)
+            for (size_t i=0; i<size(); ++i, ++idx)
+              {
+                auto ai=idx.offset();
+                auto t=ai+delta;
+                if (sameSlice(t, ai))
+                  cachedResult[i]=values[t]-values[ai];
+                else
+                  cachedResult[i]=nan("");
+              }
+          else // with -ve delta, origin of result is shifted
+            for (size_t i=0; i<size(); ++i, ++idx)
+              {
+                auto ai=idx.offset();
+                auto t=ai-delta;
+                if (sameSlice(t,ai))
+                  cachedResult[i]=values[ai]-values[t];
+                else
+                  cachedResult[i]=nan("");
+              }
         }
-      else if (delta>=0)
-        for (size_t i=0; i<size(); ++i)
-          {
-            auto ai=arg->hypercube().linealIndex(hypercube().splitIndex(i));
-            auto t=ai+delta;
-            if (sameSlice(t, ai))
-              cachedResult[i]=arg->atHCIndex(t)-arg->atHCIndex(ai);
-            else
-              cachedResult[i]=nan("");
-          }
-      else // with -ve delta, origin of result is shifted
-        for (size_t i=0; i<size(); ++i)
-          {
-            auto ai=arg->hypercube().linealIndex(hypercube().splitIndex(i));
-            auto t=ai-delta;
-            if (sameSlice(t,ai))
-              cachedResult[i]=arg->atHCIndex(ai)-arg->atHCIndex(t);
-            else
-              cachedResult[i]=nan("");
-          }
     }
 
   };
@@ -392,48 +435,64 @@ namespace minsky
   struct GeneralTensorOp<OperationType::innerProduct>: public civita::CachedTensorOp
   {
     std::shared_ptr<ITensor> arg1, arg2;
-    void computeTensor() const override {//TODO: tensors of arbitrary rank
-
+    /// extent of the dimension contracted over, 1 for scalars
+    static size_t innerDim(const ITensor& x, bool last)
+    {
+      if (x.rank()==0) return 1;
+      auto dims=x.hypercube().dims();
+      return last? dims.back(): dims.front();
+    }
+    /// product of the extents of the dimensions not contracted over
+    static size_t outerDim(const ITensor& x, bool last)
+    {
+      auto dims=x.hypercube().dims();
+      size_t r=1;
+      for (size_t i=!last; i+last<dims.size(); ++i) r*=dims[i];
+      return r;
+    }
+    void computeTensor() const override {
       if (!arg1 || !arg2) return;
-      size_t m=1, n=1;   
-      if (arg1->rank()>1)
-        for (size_t i=0; i<arg1->rank()-1; i++)
-          m*=arg1->hypercube().dims()[i];
-          
-      if (arg2->rank()>1)
-        for (size_t i=1; i<arg2->rank(); i++)
-          n*=arg2->hypercube().dims()[i];     
-  	
-      size_t stride=arg2->rank()>0? arg2->hypercube().dims()[0]: 1;	 	 
-      double tmpSum;
-      for (size_t i=0; i< m; i++)
-        for (size_t j=0; j< n; j++)
-          {
-            tmpSum=0;
-            for (size_t k=0; k<stride; k++)  
-              {
-                auto v1=m>1? arg1->atHCIndex(k*m+i) : (*arg1)[k];  
-                auto v2=n>1? arg2->atHCIndex(j*stride + k) : (*arg2)[k];  
-                if (!isnan(v1) && !isnan(v2)) tmpSum+=v1*v2;
-              }
-            cachedResult[i+m*j]=tmpSum;
-          }
+      // flatten the outer dimensions of each argument, and contract a m×k by k×n matrix
+      auto k=innerDim(*arg1,true), m=outerDim(*arg1,true), n=outerDim(*arg2,false);
+      assert(cachedResult.size()==m*n);
+      if (m*n)
+        contract(m, k, n, *arg1, *arg2, &cachedResult[0]);
     }
     Timestamp timestamp() const override {return max(arg1? arg1->timestamp(): Timestamp(), arg2? arg2->timestamp(): Timestamp());}
+    /// if \a dimension names an axis of both arguments, that axis is
+    /// contracted over, otherwise the last axis of \a a1 with the first of \a a2
     void setArguments(const TensorPtr& a1, const TensorPtr& a2,
-                      const std::string&, double) override {
+                      const std::string& dimension, double) override {
       arg1=a1; arg2=a2;
-      if (arg1 && arg1->rank()!=0 && arg2 && arg2->rank()!=0) {
-        if (arg1->hypercube().dims()[arg1->rank()-1]!=arg2->hypercube().dims()[0])
-          throw std::runtime_error("inner dimensions of tensors do not match");
-        
-        auto xv1=arg1->hypercube().xvectors, xv2=arg2->hypercube().xvectors;
-        Hypercube hc;
-        hc.xvectors.insert(hc.xvectors.begin(), xv2.begin()+1, xv2.end());        
-        hc.xvectors.insert(hc.xvectors.begin(), xv1.begin(), xv1.end()-1);
-        cachedResult.hypercube(move(hc));
-                
-      }
+      invalidateCache();
+      if (!arg1 || !arg2) return;
+      auto hasAxis=[&](const ITensor& x) {
+        auto& xv=x.hypercube().xvectors;
+        return find_if(xv.begin(), xv.end(), [&](const XVector& i){return i.name==dimension;})!=xv.end();
+      };
+      if (!dimension.empty() && hasAxis(*arg1) && hasAxis(*arg2))
+        {
+          // pivot the contracted axis to the end of arg1 and start of arg2
+          vector<string> axes1;
+          for (auto& i: arg1->hypercube().xvectors)
+            if (i.name!=dimension) axes1.push_back(i.name);
+          axes1.push_back(dimension);
+          auto pivot1=make_shared<Pivot>(), pivot2=make_shared<Pivot>();
+          pivot1->setArgument(arg1);
+          pivot1->setOrientation(axes1);
+          pivot2->setArgument(arg2);
+          pivot2->setOrientation({dimension});
+          arg1=pivot1; arg2=pivot2;
+        }
+      if (innerDim(*arg1,true)!=innerDim(*arg2,false))
+        throw std::runtime_error("inner dimensions of tensors do not match");
+      auto& xv1=arg1->hypercube().xvectors, &xv2=arg2->hypercube().xvectors;
+      Hypercube hc;
+      if (!xv1.empty())
+        hc.xvectors.insert(hc.xvectors.end(), xv1.begin(), xv1.end()-1);
+      if (!xv2.empty())
+        hc.xvectors.insert(hc.xvectors.end(), xv2.begin()+1, xv2.end());
+      cachedResult.hypercube(move(hc));
     }    
   };
 
@@ -461,9 +520,9 @@ namespace minsky
     void setArguments(const TensorPtr& a1, const TensorPtr& a2,
                       const std::string&, double) override {
       arg1=a1; arg2=a2;
+      invalidateCache();
       if (!arg1 || !arg2) return;
       
-      set<size_t> newIdx;
       size_t stride=arg1->hypercube().numElements();
 
       vector<size_t> idx1(arg1->index().begin(), arg1->index().end()), idx2(arg2->index().begin(), arg2->index().end());
@@ -475,13 +534,19 @@ namespace minsky
           if (idx2.empty()) // dense arg2, generate a corresponding sparse index vector
             for (size_t i=0; i<arg2->size(); ++i)
               idx2.push_back(i);
-          
-          for (auto& i: idx1)
-            for (auto& j: idx2) 
-              newIdx.insert(i+stride*j);
+
+          // idx1 elements are less than stride, so with idx2 outermost,
+          // the result is generated in sorted order
+          vector<size_t> newIdx;
+          newIdx.reserve(idx1.size()*idx2.size());
+          for (auto& j: idx2)
+            for (auto& i: idx1)
+              newIdx.push_back(i+stride*j);
          
-          cachedResult.index(Index(newIdx));
+          cachedResult.index(Index(move(newIdx)));
         }
+      else
+        cachedResult.index(Index());
 
       auto xv1=arg1->hypercube().xvectors, xv2=arg2->hypercube().xvectors;
       Hypercube hc;
@@ -507,6 +572,7 @@ namespace minsky
     }
     void setArgument(const TensorPtr& a, const string&,double) override {
       arg=a; cachedResult.index(a->index()); cachedResult.hypercube(a->hypercube());
+      invalidateCache();
     }
     
     Timestamp timestamp() const override {return arg? arg->timestamp(): Timestamp();}
@@ -609,6 +675,7 @@ namespace minsky
                       const std::string& dim, double) override {
       
       arg1=a1; arg2=a2;
+      invalidateCache();
       if (!arg1 || !arg2) return;
       auto& xv=arg1->hypercube().xvectors;
       dimension=find_if(xv.begin(), xv.end(), [&](const XVector& i)
@@ -645,12 +712,18 @@ namespace minsky
               offsetSet.insert(i*lowerStride*arg1Dims[dimension]+j);
         }
       else
-        for (auto i: arg1->index())
-          {
-            auto splitted=arg1->hypercube().splitIndex(i);
-            splitted[dimension]=0;
-            offsetSet.insert(arg1->hypercube().linealIndex(splitted));
-          }
+        {
+          // offset with the gathered dimension zeroed
+          MultiIndex idx(arg1->hypercube());
+          auto strides=idx.strides();
+          strides[dimension]=0;
+          idx.strides(move(strides));
+          for (auto i: arg1->index())
+            {
+              idx.seek(i);
+              offsetSet.insert(idx.offset());
+            }
+        }
       offsets.clear(); offsets.insert(offsets.end(), offsetSet.begin(), offsetSet.end());
 
       // resulting hypercube is a tensor product of arg2 and the reduced arg1.
@@ -674,16 +747,20 @@ namespace minsky
       
           set<size_t> resultantIndex;
           size_t lastOuter=numeric_limits<size_t>::max();
+          // offset into arg1's hypercube with the gathered dimension removed
+          MultiIndex outer(arg1->hypercube());
+          vector<size_t> outerStrides(arg1->rank());
+          for (size_t j=0, stride=1; j<arg1->rank(); ++j)
+            if (j!=dimension)
+              {
+                outerStrides[j]=stride;
+                stride*=arg1Dims[j];
+              }
+          outer.strides(move(outerStrides));
           for (auto i: arg1Idx)
             {
-              auto splitIdx=arg1->hypercube().splitIndex(i);
-              size_t outerIdx=0, stride=1;
-              for (size_t j=0; j<arg1->rank(); ++j)
-                if (j!=dimension)
-                  {
-                    outerIdx+=stride*splitIdx[j];
-                    stride*=arg1Dims[j];
-                  }
+              outer.seek(i);
+              auto outerIdx=outer.offset();
               if (outerIdx==lastOuter) continue;
               lastOuter=outerIdx;
               for (auto j: arg2Idx)
@@ -706,7 +783,7 @@ namespace minsky
                             maxValue=x;
                             r=i;
                           }
-                        },0) {}
+                        },0) {sequential=true;}
   };
   
   template <>
@@ -719,7 +796,7 @@ namespace minsky
                             minValue=x;
                             r=i;
                           }
-                        },0) {}
+                        },0) {sequential=true;}
   };
   
   class SwitchTensor: public ITensor
@@ -738,7 +815,7 @@ namespace minsky
       set<size_t> indices;
       for (auto& i: args)
         {
-          for (auto& j: i->index())
+          for (auto j: i->index())
             indices.insert(j);
           if (i->size()>1)
             {
@@ -754,7 +831,7 @@ namespace minsky
     }
     size_t size() const override {return m_size;}
     Timestamp timestamp() const override {
-      Timestamp t;
+      Timestamp t=0;
       for (auto& i: args)
         {
           auto tt=i->timestamp();
@@ -788,19 +865,38 @@ namespace minsky
   class RavelTensor: public civita::ITensor
   {
     const Ravel& ravel;
+    /// the chain's operations evaluate the argument it was last
+    /// updated with, so it is not shared with other RavelTensors
+    shared_ptr<RavelChain> ravelChain;
     vector<TensorPtr> chain;
     
     CLASSDESC_ACCESS(Ravel);
   public:
-    RavelTensor(const Ravel& ravel): ravel(ravel) {}
+    /// if \a forEquations, takes over the Ravel's cached chain, unless
+    /// already taken by another tensor of the current equations
+    RavelTensor(const Ravel& ravel, bool forEquations): ravel(ravel) {
+      if (forEquations && !ravel.ravelChainClaimed)
+        {
+          if (!ravel.ravelChain)
+            ravel.ravelChain=make_shared<RavelChain>();
+          ravelChain=ravel.ravelChain;
+          ravel.ravelChainClaimed=true;
+        }
+      else
+        ravelChain=make_shared<RavelChain>();
+    }
 
     void setArgument(const TensorPtr& a,const std::string&,double) override {
       // not sure how to avoid this const cast here
       const_cast<Ravel&>(ravel).populateHypercube(a->hypercube());
-      chain=civita::createRavelChain(ravel.getState(), a);
+      chain=ravelChain->update(ravel.getState(), a);
     }
 
     double operator[](size_t i) const override {return chain.empty()? 0: (*chain.back())[i];}
+    void evaluate(double* r, size_t begin, size_t end) const override {
+      if (chain.empty()) std::fill(r, r+(end-begin), 0);
+      else chain.back()->evaluate(r, begin, end);
+    }
     size_t size() const override {return chain.empty()? 1: chain.back()->size();}
     const Index& index() const override
     {return chain.empty()? m_index: chain.back()->index();}
@@ -809,6 +905,20 @@ namespace minsky
     const Hypercube& hypercube() const override {return chain.empty()? m_hypercube: chain.back()->hypercube();}
   };
 
+  /// chain of elementwise operations compiled into a single kernel,
+  /// with derivatives supplied by the original operations
+  struct FusedTensorOp: public civita::FusedElementWiseOp, public DerivativeMixin
+  {
+    FusedTensorOp(const TensorPtr& root): FusedElementWiseOp(root) {}
+    const DerivativeMixin& derivative() const {
+      if (auto d=dynamic_cast<const DerivativeMixin*>(root().get()))
+        return *d;
+      throw DerivativeNotDefined();
+    }
+    double dFlow(size_t ti, size_t fi) const override {return derivative().dFlow(ti,fi);}
+    double dStock(size_t ti, size_t si) const override {return derivative().dStock(ti,si);}
+  };
+  
   namespace
   {
     // used to mark the exception as already dealt with, in terms of displayErrorItem
@@ -823,7 +933,7 @@ namespace minsky
   {
     if (auto ravel=dynamic_cast<const Ravel*>(it.get()))
 	    {
-	      auto r=make_shared<RavelTensor>(*ravel);
+	      auto r=make_shared<RavelTensor>(*ravel, tfp.forEquations);
 	      r->setArguments(tfp.tensorsFromPorts(*it));
 	      return r;
 	    }
@@ -842,6 +952,11 @@ namespace minsky
               r->setArguments(tfp.tensorsFromPort(*op->ports(1).lock()), tfp.tensorsFromPort(*op->ports(2).lock()),op->axis,op->arg);
               break;
             }
+          // compile chains of elementwise operations into a single
+          // kernel. Fused arguments are inlined into the kernel, so
+          // the outermost operation of a chain ends up with all of it
+          if (FusedElementWiseOp::fusableOps(*r)>1)
+            return make_shared<FusedTensorOp>(r);
           return r;
         }
       catch (const InvalidType&)
@@ -928,7 +1043,7 @@ namespace minsky
   }
 
   TensorEval::TensorEval(const shared_ptr<VariableValue>& dest, const shared_ptr<VariableValue>& src):
-    result(dest,make_shared<EvalCommon>())
+    result(dest,make_shared<EvalCommon>()), copySrc(src)
   {
     result.index(src->index());
     result.hypercube(src->hypercube());
@@ -945,8 +1060,14 @@ namespace minsky
       {
         assert(result.idx()>=0);
         bool fvIsGlobalFlowVars=fv==ValueVector::flowVars.data();
-        result.index(rhs->index());
-        result.hypercube(rhs->hypercube());
+        // only update the result's structure when changed, to avoid
+        // reallocating on every evaluation
+        auto& rhsIndex=rhs->index();
+        if (result.index().size()!=rhsIndex.size() ||
+            !std::equal(rhsIndex.begin(), rhsIndex.end(), result.index().begin()))
+          result.index(rhsIndex);
+        if (result.hypercube()!=rhs->hypercube())
+          result.hypercube(rhs->hypercube());
         if (fvIsGlobalFlowVars) // hypercube operation may have resized flowVars, invalidating fv
           {
             fv=ValueVector::flowVars.data();
@@ -956,12 +1077,8 @@ namespace minsky
           throw FlowVarsResized();
         result.ev->update(fv, n, sv);
         assert(result.size()==rhs->size());
-        for (size_t i=0; i<rhs->size(); ++i)
-          {
-            auto v=(*rhs)[i];
-            result[i]=v;
-            assert(!isfinite(result[i]) || fv[result.idx()+i]==v);
-          }
+        assert(result.value->isFlowVar() && result.idx()+rhs->size()<=n);
+        rhs->evaluate(fv+result.idx(), 0, rhs->size());
       }
   }
    
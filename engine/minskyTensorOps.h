@@ -37,7 +37,7 @@ namespace minsky
     double* m_flowVars=nullptr;
     std::size_t m_fvSize=0;
     const double* m_stockVars=nullptr;
-    ITensor::Timestamp m_timestamp;
+    ITensor::Timestamp m_timestamp=0;
   public:
     double* flowVars() const {return m_flowVars;}
     std::size_t fvSize() const {return m_fvSize;}
@@ -49,15 +49,19 @@ namespace minsky
     /// @param sv - pointer to stock variable vector
     void update(double* fv, std::size_t n, const double* sv)
     {
-      m_flowVars=fv; m_fvSize=n; m_stockVars=sv; m_timestamp=ITensor::Timestamp::clock::now();
+      m_flowVars=fv; m_fvSize=n; m_stockVars=sv; m_timestamp=ITensor::newTimestamp();
     }
   };
 
   struct TensorsFromPort
   {
     shared_ptr<EvalCommon> ev;
+    /// tensors are for the model's equations, so may take over state
+    /// cached on the items, such as Ravel chains
+    bool forEquations=false;
     TensorsFromPort() {}
-    TensorsFromPort(const shared_ptr<EvalCommon>& ev): ev(ev) {}
+    TensorsFromPort(const shared_ptr<EvalCommon>& ev, bool forEquations=false):
+      ev(ev), forEquations(forEquations) {}
     
     /// returns vector of tensor ops for all wires attach to port. Port
     /// must be an input port
@@ -102,11 +106,24 @@ namespace minsky
 
     int idx() const {return value->idx();}
     
-    /// 
-    ITensor::Timestamp timestamp() const override {return ev->timestamp();}
+    /// parameters only change when assigned, other values whenever
+    /// the equations are evaluated
+    ITensor::Timestamp timestamp() const override {
+      switch (value->type())
+        {
+        case VariableType::constant: case VariableType::parameter:
+          return value->timestamp();
+        default:
+          return ev->timestamp();
+        }
+    }
     double operator[](std::size_t i) const override {
       return value->isFlowVar()? ev->flowVars()[value->idx()+i]: ev->stockVars()[value->idx()+i];
     }
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      auto v=(value->isFlowVar()? ev->flowVars(): ev->stockVars())+value->idx();
+      std::copy(v+begin, v+end, r);
+    }
     TensorVarValBase(const std::shared_ptr<VV>& vv, const shared_ptr<EvalCommon>& ev):
       value(vv), ev(ev) {}
     const Hypercube& hypercube() const override {return value->hypercube();}
@@ -154,8 +171,12 @@ namespace minsky
   {
     TensorVarVal result;
     TensorPtr rhs;
+    /// source variable when this is a plain copy, for dependency analysis
+    std::shared_ptr<const VariableValue> copySrc;
 
   public:
+    /// item from which rhs was generated, for profiling
+    std::weak_ptr<Item> item;
     // not used, but required to make this a concrete type
     Type type() const override {assert(false); return OperationType::numOps;} 
     TensorEval(const std::shared_ptr<VariableValue>& v, const shared_ptr<EvalCommon>& ev,
@@ -169,6 +190,12 @@ namespace minsky
                
     void eval(double fv[], std::size_t,const double sv[]) override;
     void deriv(double df[],std::size_t,const double ds[],const double sv[],const double fv[]) override;
+    std::pair<int,std::size_t> outputRange() const override {return {result.idx(), result.size()};}
+    bool dependencies(std::size_t i, const std::function<void(bool,std::size_t)>& f) const override {
+      if (!copySrc || copySrc->idx()<0) return false;
+      f(copySrc->isFlowVar(), copySrc->idx()+i);
+      return true;
+    }
   };
 }
   
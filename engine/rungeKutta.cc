@@ -21,11 +21,17 @@
 #include "variableValue.h"
 #include "error.h"
 #include "matrix.h"
+#include "minskyTensorOps.h"
 #include "minsky.h"
 #include "minsky_epilogue.h"
 
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_odeiv2.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <vector>
 
 //#include <thread>
@@ -91,21 +97,34 @@ namespace minsky
       sys.dimension=minsky->stockVars.size();
       sys.params=minsky;
       const gsl_odeiv2_step_type* stepper;
-      switch (minsky->order)
+      switch (minsky->solver)
         {
-        case 1: 
-          if (!minsky->implicit)
-            throw ecolab::error("First order explicit solver not available");
-          stepper=gsl_odeiv2_step_rk1imp;
-          break;
-        case 2: 
-          stepper=minsky->implicit? gsl_odeiv2_step_rk2imp: gsl_odeiv2_step_rk2;
-          break;
-        case 4:
-          stepper=minsky->implicit? gsl_odeiv2_step_rk4imp: gsl_odeiv2_step_rkf45;
+        case Simulation::standard:
+          switch (minsky->order)
+            {
+            case 1: 
+              if (!minsky->implicit)
+                throw ecolab::error("First order explicit solver not available");
+              stepper=gsl_odeiv2_step_rk1imp;
+              break;
+            case 2: 
+              stepper=minsky->implicit? gsl_odeiv2_step_rk2imp: gsl_odeiv2_step_rk2;
+              break;
+            case 4:
+              stepper=minsky->implicit? gsl_odeiv2_step_rk4imp: gsl_odeiv2_step_rkf45;
+              break;
+            default:
+              throw ecolab::error("order %d solver not supported",minsky->order);
+            }
           break;
+        case Simulation::rkck: stepper=gsl_odeiv2_step_rkck; break;
+        case Simulation::rk8pd: stepper=gsl_odeiv2_step_rk8pd; break;
+        // the following use the Jacobian
+        case Simulation::bsimp: stepper=gsl_odeiv2_step_bsimp; break;
+        case Simulation::msadams: stepper=gsl_odeiv2_step_msadams; break;
+        case Simulation::msbdf: stepper=gsl_odeiv2_step_msbdf; break;
         default:
-          throw ecolab::error("order %d solver not supported",minsky->order);
+          throw ecolab::error("unknown solver %d",int(minsky->solver));
         }
       driver = gsl_odeiv2_driver_alloc_y_new
         (&sys, stepper, minsky->stepMax, minsky->epsAbs, 
@@ -116,69 +135,250 @@ namespace minsky
     ~RKdata() {gsl_odeiv2_driver_free(driver);}
   };
 
+  namespace
+  {
+    /// records its lifetime into \a stats, if enabled
+    struct Timer
+    {
+      TimingStats* stats;
+      chrono::steady_clock::time_point start;
+      Timer(TimingStats& stats, bool enabled): stats(enabled? &stats: nullptr) {
+        if (enabled) start=chrono::steady_clock::now();
+      }
+      ~Timer() {
+        if (stats)
+          stats->record(chrono::duration<double>(chrono::steady_clock::now()-start).count());
+      }
+    };
+  }
+
+  /// Persistent thread running commands posted by the GUI thread,
+  /// so that each step does not pay thread creation costs. See ticket #6
+  struct RKThread
+  {
+    boost::mutex mutex;
+    boost::condition_variable cv;
+    std::deque<std::function<void()>> commands;
+    bool busy=false, quit=false;
+    boost::thread thread;
+
+    RKThread(): thread([this]{run();}) {}
+    /// completes any command in progress before returning
+    ~RKThread() {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        quit=true;
+      }
+      cv.notify_all();
+      thread.join();
+    }
+
+    void run() {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      for (;;)
+        {
+          cv.wait(lock, [this]{return quit || !commands.empty();});
+          if (quit) return;
+          auto command=std::move(commands.front());
+          commands.pop_front();
+          lock.unlock();
+          command(); // commands must not throw
+          lock.lock();
+          busy=!commands.empty();
+          cv.notify_all();
+        }
+    }
+
+    /// queue \a command for execution on this thread
+    void post(std::function<void()> command) {
+      {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        commands.push_back(std::move(command));
+        busy=true;
+      }
+      cv.notify_all();
+    }
+
+    /// @return true if all posted commands have completed
+    bool idle() {
+      boost::lock_guard<boost::mutex> lock(mutex);
+      return !busy;
+    }
+    
+    /// wait for all posted commands to complete
+    void waitIdle() {
+      boost::unique_lock<boost::mutex> lock(mutex);
+      cv.wait(lock, [this]{return !busy;});
+    }
+
+    /// wait for all posted commands to complete, processing any UI
+    /// events whilst waiting. Commands refer to their poster's state,
+    /// so the wait is always completed.
+    /// @return the first exception thrown by processing UI events, if any
+    std::exception_ptr waitProcessingEvents() {
+      std::exception_ptr eventErr;
+      boost::unique_lock<boost::mutex> lock(mutex);
+      while (!cv.timed_wait(lock, boost::posix_time::milliseconds(1), [this]{return !busy;}))
+        {
+          lock.unlock();
+          try
+            {
+              doOneEvent(false);
+            }
+          catch (...)
+            {
+              if (!eventErr) eventErr=std::current_exception();
+            }
+          lock.lock();
+        }
+      return eventErr;
+    }
+  };
+
+  RungeKutta::~RungeKutta()
+  {
+    // finish any step in progress, which refers to this
+    rkThread.reset();
+  }
+  
   void RungeKutta::reset()
   {
-    if (order==1 && !implicit)
+    // any step result not yet applied is for the old equations
+    stepPending=false;
+    // once the simulation thread exists, the solver state belongs to
+    // it, so reinitialise it there, after any commands in progress
+    if (!rkThread)
+      {
+        resetSolver();
+        return;
+      }
+    std::exception_ptr err;
+    rkThread->post([this,&err]() {
+      try {resetSolver();}
+      catch (...) {err=std::current_exception();}
+    });
+    rkThread->waitIdle();
+    if (err) std::rethrow_exception(err);
+  }
+
+  void RungeKutta::resetSolver()
+  {
+    computeJacobianSparsity();
+    // compiled whilst no step is in progress, as the GUI thread reads the profile whilst stepping
+    profile.compile(equations);
+    opCostKeys.clear();
+    for (auto& e: equations)
+      opCostKeys.push_back(!e? "": dynamic_cast<TensorEval*>(e.get())? "tensor": OperationType::typeName(e->type()));
+    computedFlows.clear();
+    for (auto& e: equations)
+      if (e)
+        {
+          auto range=e->outputRange();
+          if (range.first>=0 && range.first+range.second<=flowVars.size())
+            computedFlows.emplace_back(range.first, range.first+range.second);
+        }
+    for (firstUserFunction=0; firstUserFunction<equations.size(); ++firstUserFunction)
+      if (equations[firstUserFunction] && equations[firstUserFunction]->type()==OperationType::userFunction)
+        break;
+    tape.compile(equations);
+    schedule.clear();
+    if (parallelEvalThreshold>0 && equations.size()>=parallelEvalThreshold)
+      {
+        schedule.compile(equations, flowVars.size());
+        if (schedule.width()<2) schedule.clear();
+      }
+    flowScratch.resize(flowVars.size());
+    dfScratch.resize(flowVars.size());
+    dsScratch.resize(stockVars.size());
+    dScratch.resize(stockVars.size());
+    if (solver==standard && order==1 && !implicit)
       ode.reset(); // do explicit Euler
     else
       ode.reset(new RKdata(this)); // set up GSL ODE routines
   }
 
-  void RungeKutta::step()
+  void RungeKutta::startStep()
   {
-    if (nSteps<1) return;
+    if (nSteps<1 || stepPending) return;
     resetIfFlagged();
     running=true;
     
-    // create a private copy for worker thread use
-    vector<double> stockVarsCopy(stockVars);
+    // the worker thread integrates private copies of the variables,
+    // so the GUI thread only ever sees complete sets of values
+    stockVarsBuffer.assign(stockVars.begin(), stockVars.end());
+    flowVarsBuffer.assign(flowVars.begin(), flowVars.end());
+    stepStatus=GSL_SUCCESS;
+    threadErrMsg.clear();
     RKThreadRunning=true;
-    int err=GSL_SUCCESS;
+    stepPending=true;
     // run RK algorithm on a separate worker thread so as to not block UI. See ticket #6
-    boost::thread rkThread([&]() {
-      try
-        { 
-          double tp=reverse? -t: t;
-          if (ode)
-            {
-              gsl_odeiv2_driver_set_nmax(ode->driver, nSteps);
-              // we need to update Minsky's t synchronously to support the t operator
-              // potentially means t and stockVars out of sync on GUI, but should still be thread safe
-              err=gsl_odeiv2_driver_apply(ode->driver, &tp, numeric_limits<double>::max(), 
-                                          &stockVarsCopy[0]);
-            }
-          else // do explicit Euler method
-            {
-              vector<double> d(stockVarsCopy.size());
-              for (int i=0; i<nSteps; ++i, tp+=stepMax)
-                {
-                  evalEquations(&d[0], tp, &stockVarsCopy[0]);
-                  for (size_t j=0; j<d.size(); ++j)
-                    stockVarsCopy[j]+=d[j];
-                }
-            }
-          t=reverse? -tp:tp;
-        }
-      catch (const std::exception& ex)
-        {
-          // catch any thrown exception, and report back to GUI thread
-          threadErrMsg=ex.what();
-        }
-      catch (...)
-        {
-          threadErrMsg="Unknown exception thrown on ODE solver thread";
-        }
-      RKThreadRunning=false;
-    });
+    if (!rkThread) rkThread=make_shared<RKThread>();
+    rkThread->post([this]{computeStep();});
+  }
 
-    while (RKThreadRunning)
+  void RungeKutta::computeStep()
+  {
+    try
+      { 
+        double tp=reverse? -t: t;
+        if (ode)
+          {
+            gsl_odeiv2_driver_set_nmax(ode->driver, nSteps);
+            auto& evolve=*ode->driver->e;
+            auto count=evolve.count, failedSteps=evolve.failed_steps;
+            // we need to update Minsky's t synchronously to support the t operator
+            // potentially means t and stockVars out of sync on GUI, but should still be thread safe
+            stepStatus=gsl_odeiv2_driver_apply(ode->driver, &tp, numeric_limits<double>::max(), 
+                                               &stockVarsBuffer[0]);
+            if (solverStats.enabled)
+              {
+                solverStats.steps+=evolve.count-count;
+                solverStats.rejectedSteps+=evolve.failed_steps-failedSteps;
+                solverStats.recordStepSize(evolve.last_step);
+              }
+          }
+        else // do explicit Euler method
+          {
+            auto& d=dScratch;
+            d.resize(stockVarsBuffer.size());
+            for (int i=0; i<nSteps; ++i, tp+=stepMax)
+              {
+                evalEquations(&d[0], tp, &stockVarsBuffer[0]);
+                for (size_t j=0; j<d.size(); ++j)
+                  stockVarsBuffer[j]+=d[j];
+              }
+            if (solverStats.enabled)
+              {
+                solverStats.steps+=nSteps;
+                solverStats.recordStepSize(stepMax);
+              }
+          }
+        t=reverse? -tp:tp;
+        // update flow variables
+        if (stepStatus==GSL_SUCCESS || stepStatus==GSL_EMAXITER)
+          {
+            EvalOpBase::t=t;
+            evalFlows(flowVarsBuffer.data(), flowVarsBuffer.size(), stockVarsBuffer.data());
+          }
+      }
+    catch (const std::exception& ex)
       {
-        // while waiting for thread to finish, check and process any UI events
-        usleep(1000);
-        doOneEvent(false);
+        // catch any thrown exception, and report back to GUI thread
+        threadErrMsg=ex.what();
       }
-    rkThread.join();
+    catch (...)
+      {
+        threadErrMsg="Unknown exception thrown on ODE solver thread";
+      }
+    RKThreadRunning=false;
+  }
 
+  bool RungeKutta::stepComplete()
+  {
+    if (!stepPending) return true;
+    if (!rkThread->idle()) return false;
+    stepPending=false;
+    
     if (!threadErrMsg.empty())
       {
         auto msg=std::move(threadErrMsg);
@@ -188,9 +388,9 @@ namespace minsky
       }
 
     if (resetIfFlagged())
-      return; // in case reset() was called during the step evaluation
+      return true; // in case reset() was called during the step evaluation
 
-    switch (err)
+    switch (stepStatus)
       {
       case GSL_SUCCESS: case GSL_EMAXITER: break;
       case GSL_FAILURE:
@@ -199,42 +399,222 @@ namespace minsky
         gsl_odeiv2_driver_reset(ode->driver);
         throw error("Invalid arithmetic operation detected");
       default:
-        throw error("gsl error: %s",gsl_strerror(err));
+        throw error("gsl error: %s",gsl_strerror(stepStatus));
+      }
+
+    // assigned rather than swapped, so stockVars' storage stays put
+    stockVars.assign(stockVarsBuffer.begin(), stockVarsBuffer.end());
+    // only the computed flow variables are taken from the step, so
+    // that inputs changed by the GUI during the step are retained
+    if (flowVarsBuffer.size()==flowVars.size())
+      {
+        for (auto& i: computedFlows)
+          copy(flowVarsBuffer.begin()+i.first, flowVarsBuffer.begin()+i.second, flowVars.begin()+i.first);
+        // the worker's user functions read the values at the start of the step
+        for (size_t i=firstUserFunction; i<equations.size(); ++i)
+          if (equations[i])
+            equations[i]->eval(&flowVars[0], flowVars.size(), &stockVars[0]);
+      }
+    else
+      evalEquations();
+    return true;
+  }
+
+  void RungeKutta::step()
+  {
+    startStep();
+    if (!stepPending) return;
+    // while waiting for thread to finish, check and process any UI events
+    auto eventErr=rkThread->waitProcessingEvents();
+    // an error processing events happened first, so takes precedence
+    try
+      {
+        stepComplete();
+      }
+    catch (...)
+      {
+        if (!eventErr) throw;
+      }
+    if (eventErr) std::rethrow_exception(eventErr);
+  }
+
+  void RungeKutta::computeJacobianSparsity()
+  {
+    jacobianColumnRows.clear();
+    jacobianColours.clear();
+    if (!sparseJacobian) return;
+
+    // stock variables each flow variable structurally depends upon
+    vector<vector<size_t>> flowDeps(flowVars.size());
+    vector<bool> denseFlow(flowVars.size());
+    bool dense;
+    vector<size_t> deps;
+    auto addDep=[&](bool isFlow, size_t idx) {
+      if (!isFlow)
+        {
+          if (idx<stockVars.size()) deps.push_back(idx);
+        }
+      else if (idx<flowVars.size())
+        {
+          if (denseFlow[idx]) dense=true;
+          deps.insert(deps.end(), flowDeps[idx].begin(), flowDeps[idx].end());
+        }
+    };
+    auto normalise=[](vector<size_t>& x) {
+      sort(x.begin(), x.end());
+      x.erase(unique(x.begin(), x.end()), x.end());
+    };
+
+    for (auto& eq: equations)
+      {
+        auto range=eq->outputRange();
+        if (range.first<0) continue;
+        for (size_t i=0; i<range.second && range.first+i<flowVars.size(); ++i)
+          {
+            deps.clear();
+            dense=!eq->dependencies(i, addDep);
+            normalise(deps);
+            // evaluate deps before assigning, as output may also be an input
+            denseFlow[range.first+i]=dense;
+            flowDeps[range.first+i].swap(deps);
+          }
       }
 
-    stockVars.swap(stockVarsCopy);
+    // now compute the stock variable derivatives' dependencies
+    vector<vector<size_t>> rowDeps(stockVars.size());
+    dense=false;
+    evalGodley.forEachFlow([&](int s, int f) {
+        if (s<0 || size_t(s)>=stockVars.size()) return;
+        deps.clear();
+        addDep(true, f);
+        rowDeps[s].insert(rowDeps[s].end(), deps.begin(), deps.end());
+      });
+    for (auto& i: integrals)
+      {
+        if (i.stock->idx()<0 || i.input().idx()<0) continue;
+        for (size_t j=0; j<i.input().size(); ++j)
+          {
+            auto row=i.stock->idx()+j;
+            if (row>=stockVars.size()) continue;
+            deps.clear();
+            addDep(i.input().isFlowVar(), i.input().idx()+j);
+            rowDeps[row].insert(rowDeps[row].end(), deps.begin(), deps.end());
+          }
+      }
+    // if any stock derivative depends on unknown structure, just use the dense algorithm
+    if (dense) return;
 
-    // update flow variables
-    evalEquations();
+    jacobianColumnRows.resize(stockVars.size());
+    for (size_t i=0; i<rowDeps.size(); ++i)
+      {
+        normalise(rowDeps[i]);
+        for (auto j: rowDeps[i])
+          jacobianColumnRows[j].push_back(i);
+      }
 
+    // greedy colouring of columns, such that no two columns of the
+    // same colour share a nonzero row
+    vector<size_t> colour(stockVars.size());
+    vector<size_t> forbidden; // forbidden[c]==j+1 means colour c not available to column j
+    for (size_t j=0; j<stockVars.size(); ++j)
+      {
+        for (auto i: jacobianColumnRows[j])
+          for (auto k: rowDeps[i])
+            if (k<j)
+              {
+                if (colour[k]>=forbidden.size()) forbidden.resize(colour[k]+1);
+                forbidden[colour[k]]=j+1;
+              }
+        size_t c=0;
+        for (; c<forbidden.size() && forbidden[c]==j+1; ++c);
+        colour[j]=c;
+        if (c>=jacobianColours.size()) jacobianColours.resize(c+1);
+        jacobianColours[c].push_back(j);
+      }
+  }
+
+  void RungeKutta::evalFlows(double fv[], size_t n, const double sv[])
+  {
+    bool opTiming=solverStats.enabled && solverStats.opTiming && opCostKeys.size()==equations.size();
+    if (profiling || opTiming)
+      {
+        for (size_t i=0; i<equations.size(); ++i)
+          {
+            auto& eq=*equations[i];
+            auto start=chrono::steady_clock::now();
+            eq.eval(fv, n, sv);
+            double time=chrono::duration<double>(chrono::steady_clock::now()-start).count();
+            if (profiling)
+              profile.record(i, time);
+            if (opTiming)
+              solverStats.opCost[opCostKeys[i]].record(time);
+          }
+      }
+    else if (!schedule.empty())
+      schedule.eval(fv, n, sv);
+    else if (evalTape && !tape.empty())
+      tape.eval(fv, n, sv);
+    else
+      for (auto& eq: equations)
+        eq->eval(fv, n, sv);
   }
 
   void RungeKutta::evalJacobian(Matrix& jac, double t, const double sv[])
   {
+    Timer timer(solverStats.evalJacobian, solverStats.enabled);
     EvalOpBase::t=reverse? -t: t;
     double reverseFactor=reverse? -1: 1;
     // firstly evaluate the flow variables. Initialise to flowVars so
     // that no input vars are correctly initialised
-    vector<double> flow=flowVars;
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flow[0], flow.size(), sv);
+    auto& flow=flowScratch;
+    flow.assign(flowVars.begin(), flowVars.end());
+    evalFlows(&flow[0], flow.size(), sv);
 
+    // compute the directional derivative of the stock variables along ds
+    auto derivative=[&](vector<double>& d, const vector<double>& ds) {
+      auto& df=dfScratch;
+      df.assign(flowVars.size(), 0);
+      for (size_t i=0; i<equations.size(); ++i)
+        equations[i]->deriv(&df[0], df.size(), &ds[0], sv, &flow[0]);
+      evalGodley.eval(&d[0], &df[0]);
+      for (auto& i: integrals)
+        {
+          assert(i.stock->idx()>=0 && i.input().idx()>=0);
+          for (size_t j=0; j<i.input().size(); ++j)
+            d[i.stock->idx()+j] = 
+              i.input().isFlowVar()? df[i.input().idx()+j]: ds[i.input().idx()+j];
+        }
+    };
+    
+    if (jacobianColumnRows.size()==stockVars.size() && !jacobianColours.empty())
+      {
+        // columns of the same colour do not share any rows, so can
+        // be computed in a single pass
+        for (size_t i=0; i<stockVars.size(); i++)
+          for (size_t j=0; j<stockVars.size(); j++)
+            jac(i,j)=0;
+        for (auto& colour: jacobianColours)
+          {
+            auto& ds=dsScratch, &d=dScratch;
+            ds.assign(stockVars.size(), 0);
+            d.assign(stockVars.size(), 0);
+            for (auto j: colour) ds[j]=1;
+            derivative(d, ds);
+            for (auto j: colour)
+              for (auto i: jacobianColumnRows[j])
+                jac(i,j)=reverseFactor*d[i];
+          }
+        return;
+      }
+    
     // then determine the derivatives with respect to variable j
+    auto& ds=dsScratch, &d=dScratch;
     for (size_t j=0; j<stockVars.size(); ++j)
       {
-        vector<double> ds(stockVars.size()), df(flowVars.size());
+        ds.assign(stockVars.size(), 0);
+        d.assign(stockVars.size(), 0);
         ds[j]=1;
-        for (size_t i=0; i<equations.size(); ++i)
-          equations[i]->deriv(&df[0], df.size(), &ds[0], sv, &flow[0]);
-        vector<double> d(stockVars.size());
-        evalGodley.eval(&d[0], &df[0]);
-        for (vector<Integral>::iterator i=integrals.begin(); 
-             i!=integrals.end(); ++i)
-          {
-            assert(i->stock->idx()>=0 && i->input().idx()>=0);
-            d[i->stock->idx()] = 
-              i->input().isFlowVar()? df[i->input().idx()]: ds[i->input().idx()];
-          }
+        derivative(d, ds);
         for (size_t i=0; i<stockVars.size(); i++)
           jac(i,j)=reverseFactor*d[i];
       }
@@ -243,17 +623,21 @@ namespace minsky
   
   void RungeKutta::evalEquations(double result[], double t, const double vars[])
   {
+    Timer timer(solverStats.evalEquations, solverStats.enabled);
     EvalOpBase::t=reverse? -t: t;
     double reverseFactor=reverse? -1: 1;
     // firstly evaluate the flow variables. Initialise to flowVars so
     // that no input vars are correctly initialised
-    vector<double> flow(flowVars);
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flow[0], flow.size(), vars);
+    auto& flow=flowScratch;
+    flow.assign(flowVars.begin(), flowVars.end());
+    evalFlows(&flow[0], flow.size(), vars);
 
     // then create the result using the Godley table
     for (size_t i=0; i<stockVars.size(); ++i) result[i]=0;
-    evalGodley.eval(result, &flow[0]);
+    {
+      Timer timer(solverStats.evalGodley, solverStats.enabled);
+      evalGodley.eval(result, &flow[0]);
+    }
 
     // integrations are kind of a copy
     for (vector<Integral>::iterator i=integrals.begin(); i<integrals.end(); ++i)
@@ -22,24 +22,67 @@
 #include "simulation.h"
 #include "evalOp.h"
 #include "evalGodley.h"
+#include "evalTape.h"
+#include "evalSchedule.h"
+#include "evalProfile.h"
+#include "solverStats.h"
 #include "integral.h"
 
 namespace minsky
 {
   struct RKdata; // an internal structure for holding Runge-Kutta data
+  struct RKThread; // persistent simulation worker thread
   class Matrix; // convenience class for accessing matrix elements from a data array
 
   /// components excluded from reflection
   struct RungeKuttaExclude
   {
+    /// evaluation time attributed to canvas items, when profiling
+    EvalProfile profile;
   protected:
     std::shared_ptr<RKdata> ode;
     EvalOpVector equations;
+    /// equations compiled for fast evaluation by the ODE solver
+    EvalTape tape;
+    /// equations partitioned into levels for parallel evaluation,
+    /// empty if the model is too small or narrow to benefit
+    EvalSchedule schedule;
     std::vector<Integral> integrals;
     /// used to report a thrown exception on the simulation thread
     std::string threadErrMsg;
     /// flag indicates that RK engine is computing a step
     volatile bool RKThreadRunning=false;
+    /// worker thread on which steps are computed, created on first step
+    std::shared_ptr<RKThread> rkThread;
+    /// back buffer of stock variables integrated by the worker
+    /// thread, copied to stockVars on completion of a step. stockVars'
+    /// storage never moves, as user functions refer to it.
+    std::vector<double> stockVarsBuffer;
+    /// back buffer of flow variables evaluated by the worker thread,
+    /// whose computedFlows are copied to flowVars on completion of a step
+    std::vector<double> flowVarsBuffer;
+    /// ranges [first,second) of flow variables written by the equations
+    std::vector<std::pair<std::size_t,std::size_t>> computedFlows;
+    /// index of the first equation evaluating a user function. User
+    /// functions read stockVars and flowVars rather than the worker's
+    /// buffers, so equations from here on are reevaluated once a
+    /// step's results are applied.
+    std::size_t firstUserFunction=0;
+    /// GSL status of the step computed by the worker thread
+    int stepStatus=0;
+    /// a step has been started, whose result has not yet been applied
+    bool stepPending=false;
+    /// Jacobian sparsity pattern: the stock variable rows
+    /// structurally nonzero in each column
+    std::vector<std::vector<std::size_t>> jacobianColumnRows;
+    /// groups of Jacobian columns with disjoint rows, which can be
+    /// seeded together. Empty if Jacobian must be computed densely
+    std::vector<std::vector<std::size_t>> jacobianColours;
+    /// scratch buffers used by the ODE callbacks, sized at reset() so
+    /// that no heap allocation occurs whilst integrating
+    std::vector<double> flowScratch, dfScratch, dsScratch, dScratch;
+    /// solverStats.opCost key of each equation, computed at reset()
+    std::vector<std::string> opCostKeys;
   };
   
   class RungeKutta: public Simulation, public classdesc::Exclude<RungeKuttaExclude>, public ValueVector
@@ -48,13 +91,34 @@ namespace minsky
   protected:
     void evalEquations(double result[], double, const double vars[]);
     void evalJacobian(Matrix&, double, const double vars[]);
+    /// analyse equations for the Jacobian's sparsity pattern, and
+    /// colour the columns of the Jacobian
+    void computeJacobianSparsity();
+    /// evaluate the flow variables \a fv from stock variables \a
+    /// sv. The tape and schedule are only populated between reset()
+    /// and the next change of equations.
+    void evalFlows(double fv[], std::size_t n, const double sv[]);
+    /// reinitialise the solver for the current equations
+    void resetSolver();
+    /// compute a step into the back buffers, on the worker thread
+    void computeStep();
   public:
     double t{0}; ///< time
     bool running=false; ///< controls whether simulation is running
     bool reverse=false; ///< reverse direction of simulation
+    bool sparseJacobian=true; ///< exploit Jacobian sparsity in implicit solvers
+    bool evalTape=true; ///< evaluate equations via compiled tape, rather than EvalOpVector
+    /// minimum number of equations for evaluating independent
+    /// equations in parallel. Set to 0 to disable parallel evaluation
+    unsigned parallelEvalThreshold=1000;
+    /// step and timing statistics, collected when solverStats.enabled is set
+    SolverStats solverStats;
+    /// attribute evaluation time to the canvas items the equations
+    /// were generated from. See exportProfile()
+    bool profiling=false;
     EvalGodley evalGodley;
 
-    virtual ~RungeKutta()=default;
+    virtual ~RungeKutta();
     /// checks whether a reset is required, and resets the simulation if so
     /// @return whether simulation was reset
     virtual bool resetIfFlagged() {return false;}
@@ -62,8 +126,23 @@ namespace minsky
     static int RKfunction(double, const double y[], double f[], void*);
     /// compute jacobian (internal use)
     static int jacobian(double, const double y[], double*, double dfdt[], void*);
-    void reset(); ///< reset the simulation
-    void step();  ///< step the equations (by n steps, default 1)
+    /// reset the simulation. The solver is reinitialised on the
+    /// simulation thread, after any step in progress
+    void reset();
+    /// step the equations (by n steps, default 1), processing UI
+    /// events until the step completes
+    void step();
+    /// start a step on the simulation thread, returning
+    /// immediately. Does nothing if a step is already in progress.
+    void startStep();
+    /// applies the result of a step started by startStep() once it
+    /// has completed, without blocking
+    /// @return true if no step remains in progress
+    /// @throw if the step failed
+    bool stepComplete();
+    /// stop running. Any step in progress completes, and its result
+    /// is applied by stepComplete()
+    void pause() {running=false;}
     /// evaluate the flow equations without stepping.
     /// @throw ecolab::error if equations are illdefined
     void evalEquations() {
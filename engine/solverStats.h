@@ -0,0 +1,84 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOLVERSTATS_H
+#define SOLVERSTATS_H
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /// call count and duration histogram of some computation
+  struct TimingStats
+  {
+    unsigned long count=0;
+    double totalTime=0; ///< in seconds
+    double maxTime=0; ///< in seconds
+    /// histogram[i] counts calls taking between 2^(i-1) and 2^i
+    /// microseconds. The last bin counts all longer calls.
+    std::vector<unsigned long> histogram=std::vector<unsigned long>(24);
+
+    void record(double seconds) {
+      ++count;
+      totalTime+=seconds;
+      if (seconds>maxTime) maxTime=seconds;
+      std::size_t bin=seconds>1e-6? std::size_t(std::ceil(std::log2(seconds*1e6))): 0;
+      ++histogram[std::min(bin, histogram.size()-1)];
+    }
+    double meanTime() const {return count? totalTime/count: 0;}
+    void clear() {*this=TimingStats();}
+  };
+
+  /// statistics collected from the ODE solver, when enabled
+  struct SolverStats
+  {
+    /// collect statistics of the evaluation path normally used
+    bool enabled=false;
+    /// whilst enabled, also collect opCost. Equations are then
+    /// evaluated one at a time, bypassing the compiled tape and
+    /// parallel schedule, so the other timings no longer reflect the
+    /// normal evaluation path
+    bool opTiming=false;
+    unsigned long steps=0; ///< steps taken
+    unsigned long rejectedSteps=0; ///< steps rejected by the error control
+    /// step sizes, sampled at the end of each call to step()
+    double lastStepSize=0, minStepSize=0, maxStepSize=0;
+    /// @{ right hand side, Jacobian and Godley table evaluations
+    TimingStats evalEquations, evalJacobian, evalGodley;
+    /// @}
+    /// equation evaluation cost by operation type
+    std::map<std::string, TimingStats> opCost;
+
+    /// record a sampled step size \a h
+    void recordStepSize(double h) {
+      h=std::fabs(h);
+      if (lastStepSize==0 || h<minStepSize) minStepSize=h;
+      if (h>maxStepSize) maxStepSize=h;
+      lastStepSize=h;
+    }
+    void clear() {bool e=enabled, o=opTiming; *this=SolverStats(); enabled=e; opTiming=o;}
+  };
+}
+
+#include "solverStats.cd"
+#include "solverStats.xcd"
+#endif
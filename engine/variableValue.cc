@@ -128,6 +128,8 @@ namespace minsky
   {
     if (m_idx==-1)
       allocValue();
+    // conservatively assume the reference is used for writing
+    m_timestamp=newTimestamp();
     switch (m_type)
       {
       case flow:
@@ -394,7 +396,7 @@ namespace minsky
       of<<"\""<<i.name<<"\",";
     of<<"value$\n";
 
-    auto idxv=index();
+    auto& idxv=index();
     size_t i=0;
     for (auto d=begin(); d!=end(); ++i, ++d)
       if (isfinite(*d))
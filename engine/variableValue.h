@@ -46,6 +46,8 @@ namespace minsky
   private:
     Type m_type;
     int m_idx; /// index into value vector
+    /// logical timestamp of the last write via valRef()
+    Timestamp m_timestamp=0;
     double& valRef(); 
     const double& valRef() const;
     std::vector<unsigned> m_dims;
@@ -90,8 +92,11 @@ namespace minsky
     int idx() const {return m_idx;}
     void reset_idx() {m_idx=-1;}    
 
-    // values are always live
-    Timestamp timestamp() const override {return Timestamp::clock::now();}
+    /// timestamp of the last write to this value other than by
+    /// evaluating equations, eg initialisation or a slider
+    /// change. Values computed by equations are timestamped by the
+    /// EvalCommon of the evaluation
+    Timestamp timestamp() const override {return m_timestamp;}
     
     double operator[](std::size_t i) const override {return *(&valRef()+i);}
     double& operator[](std::size_t i) override;
@@ -422,6 +422,7 @@ proc showPreferences {} {
 menu .menubar.rungeKutta
 .menubar.rungeKutta add command -label "Simulation" -command {
     foreach {var text} $rkVars { set rkVarInput($var) [$var] }
+    set rkVarInput(solver) [solver]
     set implicitSolver [implicit]
     deiconifyRKDataForm
     update idletasks
@@ -1325,7 +1326,7 @@ set delay [simulationDelay]
 proc runstop {} {
     global classicMode
     if [running] {
-        running 0
+        minsky.pause
         doPushHistory 1
         if {$classicMode} {
             .controls.run configure -text run
@@ -1356,17 +1357,47 @@ proc step {} {
         }
     } else {
         # run simulation
-        global preferences
         set lastt [t]
-        if {[catch minsky.step errMsg options] && [running]} {runstop}
-        if {[minsky.t0]>[t] || [minsky.tmax]<[t]} {runstop}
-        .controls.statusbar configure -text "t: $lastt Δt: [format %g [expr [t]-$lastt]]"
-        if $preferences(godleyDisplay) redrawAllGodleyTables
-        update
+        set err [catch minsky.step errMsg options]
+        stepDone $lastt $err
         return -options $options $errMsg
     }
 }
 
+# update the display after a step from time lastt, stopping the
+# simulation if it failed or left the simulation time range
+proc stepDone {lastt err} {
+    global preferences
+    if {$err && [running]} {runstop}
+    if {[minsky.t0]>[t] || [minsky.tmax]<[t]} {runstop}
+    .controls.statusbar configure -text "t: $lastt Δt: [format %g [expr [t]-$lastt]]"
+    if $preferences(godleyDisplay) redrawAllGodleyTables
+    update
+}
+
+# run a step on the simulation thread, polling for its completion so
+# that the GUI remains responsive
+proc startStep {} {
+    set lastt [t]
+    if {[catch minsky.startStep errMsg options]} {
+        stepDone $lastt 1
+        return -options $options $errMsg
+    }
+    waitForStep $lastt
+}
+
+proc waitForStep {lastt} {
+    if {[catch minsky.stepComplete done options]} {
+        stepDone $lastt 1
+        return -options $options $done
+    }
+    if {$done} {
+        stepDone $lastt 0
+        simulate
+    } else {
+        after 1 [list waitForStep $lastt]
+    }
+}
 
 proc simulate {} {
     uplevel #0 {
@@ -1374,8 +1405,12 @@ proc simulate {} {
               set d [expr int(pow(10,$delay/4.0))]
               after $d {
                   if [running] {
-                      step
-                      simulate
+                      if {$recordingReplay} {
+                          step
+                          simulate
+                      } else {
+                          startStep
+                      }
                   }
               }
         }
@@ -1389,7 +1424,7 @@ proc reset {} {
         stopRecording
         return
     }
-    running 0
+    minsky.pause
     if {$recordingReplay} {
         seek $eventRecordR 0 start
         model.clear
@@ -1615,6 +1650,10 @@ proc deiconifyRKDataForm {} {
         }
         grid [label .rkDataForm.implicitlabel -text "Implicit solver"] -column 10 -row $row -sticky e
         grid [checkbutton  .rkDataForm.implicitcheck -variable implicitSolver -command toggleImplicitSolver] -column 20 -row $row -sticky ew
+        incr row 10
+        grid [label .rkDataForm.solverlabel -text "Solver"] -column 10 -row $row -sticky e
+        grid [ttk::combobox .rkDataForm.solver -textvariable rkVarInput(solver) -state readonly \
+                  -values {standard rkck rk8pd bsimp msadams msbdf}] -column 20 -row $row -sticky ew
 
         set rkVarInput(initial_focus) ".rkDataForm.text$rowdict(Min Step Size)"
         frame .rkDataForm.buttonBar
@@ -1644,6 +1683,7 @@ proc closeRKDataForm {} {
 proc setRKparms {} {
     global rkVars rkVarInput
     foreach {var text} $rkVars { $var $rkVarInput($var) }
+    solver $rkVarInput(solver)
 }
 
 
@@ -77,6 +77,9 @@ namespace minsky
         argv0!="minsky.setGroupIconResource" &&
         argv0!="minsky.setLockIconResource" &&
         argv0!="minsky.step" &&
+        argv0!="minsky.startStep" &&
+        argv0!="minsky.stepComplete" &&
+        argv0!="minsky.pause" &&
         argv0!="minsky.running" &&
         argv0!="minsky.multipleEquities" &&
         argv0.find("minsky.panopticon")==string::npos &&
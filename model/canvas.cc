@@ -914,6 +914,25 @@ namespace minsky
          return false;
        });
 
+    if (displayProfile)
+      {
+        // attribute each profiled item's time to its visible representative
+        map<ItemPtr,double> cost;
+        double maxCost=0;
+        for (auto& e: cminsky().profile.sorted())
+          if (auto item=e.item.lock())
+            if (auto canvasItem=cminsky().canvasItemFor(*item))
+              maxCost=max(maxCost, cost[canvasItem]+=e.stats.totalTime);
+        for (auto& i: cost)
+          if (maxCost>0 && updateRegion.intersects(*i.first))
+            {
+              CairoSave cs(cairo);
+              cairo_set_source_rgba(cairo,1,0,0,0.6*i.second/maxCost);
+              cairo_rectangle(cairo,i.first->left(),i.first->top(),i.first->width(),i.first->height());
+              cairo_fill(cairo);
+            }
+      }
+
     // draw all wires - wires will go over the top of any icons. TODO
     // introduce an ordering concept if needed
     model->recursiveDo
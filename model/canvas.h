@@ -104,6 +104,9 @@ namespace minsky
     ClickType::Type clickType;
     /// for drawing error indicators on the canvas
     bool itemIndicator=false;
+    /// shade items by their share of the evaluation time collected
+    /// whilst minsky.profiling is set
+    bool displayProfile=false;
 
     /// indicates if focusFollowsMouse mode or clickToFocus is being used
     bool focusFollowsMouse=false;
@@ -122,6 +122,9 @@ namespace minsky
   {
     model->clear();
     equations.clear();
+    tape.clear();
+    schedule.clear();
+    profile.clear();
     integrals.clear();
     variableValues.clear();
     UserFunction::nextId=0;
@@ -367,6 +370,9 @@ namespace minsky
     stockVars.clear();
     flowVars.clear();
     equations.clear();
+    tape.clear();
+    schedule.clear();
+    profile.clear();
     integrals.clear();
 
     // remove all temporaries
@@ -424,6 +430,15 @@ namespace minsky
     
     EvalOpBase::timeUnit=timeUnit;
 
+    // the new equations take over the Ravels' cached chains
+    model->recursiveDo
+      (&Group::items,
+       [](const Items&, Items::const_iterator it){
+         if (auto r=dynamic_cast<const Ravel*>(it->get()))
+           r->releaseRavelChain();
+         return false;
+       });
+
     MathDAG::SystemOfEquations system(*this);
     assert(variableValues.validEntries());
     system.populateEvalOpVector(equations, integrals);
@@ -856,7 +871,19 @@ namespace minsky
   void Minsky::step()
   {
     RungeKutta::step();
+    updateAfterStep();
+  }
+
+  bool Minsky::stepComplete()
+  {
+    bool pending=stepPending;
+    if (!RungeKutta::stepComplete()) return false;
+    if (pending) updateAfterStep();
+    return true;
+  }
 
+  void Minsky::updateAfterStep()
+  {
     logVariables();
 
     model->recursiveDo
@@ -1075,31 +1102,47 @@ namespace minsky
   }
 
 
-  void Minsky::displayErrorItem(const Item& op) const
+  ItemPtr Minsky::canvasItemFor(const Item& op) const
   {
-    // this method is logically const, but because of the way
-    // canvas rendering is done, canvas state needs updating
-    auto& canvas=const_cast<Canvas&>(this->canvas);
-    canvas.item=nullptr;
+    ItemPtr r;
     if (op.visible())
-      canvas.item=canvas.model->findItem(op);
+      r=canvas.model->findItem(op);
     else if (auto v=op.variableCast())
       if (auto c=v->controller.lock())
-        displayErrorItem(*c);
+        r=canvasItemFor(*c);
 
-    if (!canvas.item)
+    if (!r)
       if (auto g=op.group.lock())
         {
           while (g && !g->visible()) g=g->group.lock();
           if (g && g->visible())
-            canvas.item=g;
+            r=g;
         }
-    
+    return r;
+  }
+
+  void Minsky::displayErrorItem(const Item& op) const
+  {
+    // this method is logically const, but because of the way
+    // canvas rendering is done, canvas state needs updating
+    auto& canvas=const_cast<Canvas&>(this->canvas);
+    canvas.item=canvasItemFor(op);
     canvas.itemIndicator=canvas.item.get();
     //requestRedraw calls back into TCL, so don't call it from the simulation thread. See ticket #973
     if (!RKThreadRunning) canvas.requestRedraw();
   }
-  
+
+  void Minsky::exportProfile(const string& filename) const
+  {
+    ofstream f(filename);
+    if (!f) throw runtime_error("cannot open "+filename);
+    if (filename.size()>=5 && filename.substr(filename.size()-5)==".json")
+      profile.exportJSON(f);
+    else
+      profile.exportCSV(f);
+    if (!f) throw runtime_error("failed to write "+filename);
+  }
+
   bool Minsky::pushHistory()
   {
     // go via a schema object, as serialising minsky::Minsky has
@@ -127,6 +127,8 @@ namespace minsky
 
     /// write current state of all variables to the log file
     void logVariables() const;
+    /// log variables and update icons and tabs after a step
+    void updateAfterStep();
 
     Exclude<boost::posix_time::ptime> lastRedraw;
 
@@ -163,6 +165,10 @@ namespace minsky
     /// @}
 
     void step();  ///< step the equations (by n steps, default 1)
+    /// applies a step started by startStep() once it has completed,
+    /// updating the display
+    /// @return true if no step remains in progress
+    bool stepComplete();
 
     bool resetIfFlagged() override {
       if (reset_flag())
@@ -276,9 +282,16 @@ namespace minsky
 
     void exportSchema(const char* filename, int schemaLevel=1) const; //NOLINT
 
+    /// the canvas item representing \a op: itself if visible, the
+    /// controller of a hidden variable, or its nearest visible group
+    ItemPtr canvasItemFor(const Item& op) const;
     /// indicate operation item has error, if visible, otherwise contining group
     void displayErrorItem(const Item& op) const;
 
+    /// write the evaluation profile collected whilst \a profiling
+    /// to \a filename, as JSON if its extension is .json, CSV otherwise
+    void exportProfile(const std::string& filename) const;
+
     /// return the AEGIS assigned version number
     static const char* minskyVersion;
     std::string ecolabVersion() const {return VERSION;}
@@ -26,6 +26,7 @@
 #include "minsky_epilogue.h"
 
 #include <string>
+#include <unordered_map>
 #include <cmath>
 using namespace std;
 
@@ -302,7 +303,8 @@ namespace
           }
         
         auto allLabels=ravel::Ravel::allSliceLabels(axis, ravel::HandleSort::none);
-        map<string,size_t> idxMap; // map index positions
+        unordered_map<string,size_t> idxMap; // map index positions
+        idxMap.reserve(allLabels.size());
         for (size_t i=0; i<allLabels.size(); ++i)
           idxMap[allLabels[i]]=i;
         vector<size_t> customOrder;
@@ -24,6 +24,7 @@
 #include "cairoRenderer.h"
 #include "dynamicRavelCAPI.h"
 #include "handleLockInfo.h"
+#include <tensorOp.h>
 
 namespace minsky 
 {
@@ -46,6 +47,13 @@ namespace minsky
     /// used entirely to defer persisted state data until after first
     /// load from a variable
     ravel::RavelState initState;
+
+    /// tensor operations implementing this Ravel in the equations,
+    /// reused across resets whilst the Ravel's state is manipulated
+    mutable classdesc::Exclude<std::shared_ptr<civita::RavelChain>> ravelChain;
+    /// ravelChain is in use by a tensor of the current equations
+    mutable bool ravelChainClaimed=false;
+    friend class RavelTensor;
     
     friend struct SchemaHelper;
 
@@ -79,6 +87,8 @@ namespace minsky
     /// return hypercube corresponding to the current Ravel state
     Hypercube hypercube() const;
     void populateHypercube(const Hypercube&);
+    /// allow a tensor of the next equations to take over the cached chain
+    void releaseRavelChain() const {ravelChainClaimed=false;}
     /// @return input rank
     unsigned maxRank() const;
     /// adjust output dimensions to first \a r handles
@@ -31,6 +31,13 @@ namespace minsky
     double epsRel{1e-2}, epsAbs{1e-3};
     int order{4};
     bool implicit{false};
+    /// ODE solver. standard selects a Runge-Kutta method by \a order
+    /// and \a implicit, the others being the GSL steppers of the same
+    /// name: rkck (Cash-Karp 4/5), rk8pd (Prince-Dormand 8/9), bsimp
+    /// (implicit Bulirsch-Stoer), msadams (variable order Adams) and
+    /// msbdf (variable order BDF, for stiff models)
+    enum Solver {standard, rkck, rk8pd, bsimp, msadams, msbdf};
+    Solver solver{standard};
     int simulationDelay{0};
     std::string timeUnit;
     double tmax{INFINITY}, t0{0};
@@ -0,0 +1,197 @@
+/*
+  @copyright Russell Standish 2021
+  @author Russell Standish
+  This file is part of Civita.
+
+  Civita is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Civita is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Civita.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "contraction.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+// std::thread not supported on MXE
+#include <boost/thread.hpp>
+#include <ecolab_epilogue.h>
+using namespace std;
+
+namespace civita
+{
+  namespace
+  {
+    /// an argument flattened into a column major matrix, either dense
+    /// or in compressed sparse column form. Missing values are dropped.
+    struct Matrix
+    {
+      size_t rows;
+      vector<double> dense;
+      /// nonzeros of column j are row[colStart[j]..colStart[j+1]), and similarly value
+      vector<size_t> colStart, row;
+      vector<double> value;
+      bool sparse() const {return !colStart.empty();}
+
+      Matrix(const ITensor& t, size_t rows, size_t cols): rows(rows)
+      {
+        auto& index=t.index();
+        vector<double> values(t.size());
+        t.evaluate(values.data(), 0, values.size());
+        // sparse traversal only pays for fairly sparse data
+        if (index.empty() || 4*index.size()>rows*cols)
+          {
+            if (index.empty())
+              dense=move(values);
+            else
+              {
+                dense.assign(rows*cols, 0);
+                for (size_t i=0; i<index.size(); ++i)
+                  dense[index[i]]=values[i];
+              }
+            for (auto& x: dense)
+              if (isnan(x)) x=0;
+            return;
+          }
+        // index is sorted, hence in column order
+        colStart.assign(cols+1, 0);
+        for (size_t i=0; i<index.size(); ++i)
+          if (!isnan(values[i]))
+            {
+              ++colStart[index[i]/rows+1];
+              row.push_back(index[i]%rows);
+              value.push_back(values[i]);
+            }
+        for (size_t j=0; j<cols; ++j)
+          colStart[j+1]+=colStart[j];
+      }
+
+      /// call f(row, value) for the nonzeros of column \a j
+      template <class F> void column(size_t j, F f) const
+      {
+        if (sparse())
+          for (auto i=colStart[j]; i<colStart[j+1]; ++i)
+            f(row[i], value[i]);
+        else
+          for (size_t i=0; i<rows; ++i)
+            if (double x=dense[i+j*rows])
+              f(i, x);
+      }
+
+      size_t nonZeros() const {return sparse()? value.size(): dense.size();}
+    };
+
+    /// columns [j0,j1) of c=a·b, where at least one of a, b is sparse
+    void sparseContract(const Matrix& a, const Matrix& b, double* c, size_t j0, size_t j1)
+    {
+      auto m=a.rows;
+      for (auto j=j0; j<j1; ++j)
+        {
+          auto cj=c+j*m;
+          fill(cj, cj+m, 0);
+          b.column(j, [&](size_t p, double bp) {
+            if (a.sparse())
+              a.column(p, [&](size_t i, double ap) {cj[i]+=ap*bp;});
+            else
+              {
+                auto ap=a.dense.data()+p*m;
+                for (size_t i=0; i<m; ++i) cj[i]+=ap[i]*bp;
+              }
+          });
+        }
+    }
+  }
+
+  void gemm(size_t m, size_t k, const double* a, const double* b, double* c, size_t j0, size_t j1)
+  {
+    fill(c+j0*m, c+j1*m, 0);
+    // block of a packed contiguously, sized to sit in L2 cache
+    const size_t mb=256, kb=128;
+    vector<double> pack(mb*kb);
+    for (size_t p0=0; p0<k; p0+=kb)
+      {
+        auto pk=min(kb, k-p0);
+        for (size_t i0=0; i0<m; i0+=mb)
+          {
+            auto im=min(mb, m-i0);
+            for (size_t p=0; p<pk; ++p)
+              copy(a+i0+(p0+p)*m, a+i0+im+(p0+p)*m, pack.begin()+p*im);
+            size_t j=j0;
+            // four columns of c at a time, so each element of the packed block is loaded once per four
+            for (; j+4<=j1; j+=4)
+              {
+                double* c0=c+i0+j*m, *c1=c0+m, *c2=c1+m, *c3=c2+m;
+                auto b0=b+p0+j*k;
+                for (size_t p=0; p<pk; ++p)
+                  {
+                    double x0=b0[p], x1=b0[p+k], x2=b0[p+2*k], x3=b0[p+3*k];
+                    auto ap=pack.data()+p*im;
+                    for (size_t i=0; i<im; ++i)
+                      {
+                        c0[i]+=ap[i]*x0;
+                        c1[i]+=ap[i]*x1;
+                        c2[i]+=ap[i]*x2;
+                        c3[i]+=ap[i]*x3;
+                      }
+                  }
+              }
+            for (; j<j1; ++j)
+              {
+                auto cj=c+i0+j*m;
+                auto bj=b+p0+j*k;
+                for (size_t p=0; p<pk; ++p)
+                  {
+                    double x=bj[p];
+                    auto ap=pack.data()+p*im;
+                    for (size_t i=0; i<im; ++i) cj[i]+=ap[i]*x;
+                  }
+              }
+          }
+      }
+  }
+
+  void contract(size_t m, size_t k, size_t n, const ITensor& a, const ITensor& b, double* c,
+                unsigned threads)
+  {
+    if (m==0 || n==0) return;
+    if (k==0)
+      {
+        fill(c, c+m*n, 0);
+        return;
+      }
+    Matrix ma(a, m, k), mb(b, k, n);
+    auto columns=[&](size_t j0, size_t j1) {
+      if (ma.sparse() || mb.sparse())
+        sparseContract(ma, mb, c, j0, j1);
+      else
+        gemm(m, k, ma.dense.data(), mb.dense.data(), c, j0, j1);
+    };
+
+    if (!threads)
+      {
+        double work=double(ma.nonZeros())*mb.nonZeros()/k;
+        threads=work>parallelContractionThreshold? max(1u, boost::thread::hardware_concurrency()): 1;
+      }
+    threads=min<size_t>(threads, n);
+    if (threads<=1)
+      {
+        columns(0, n);
+        return;
+      }
+    // share columns of c between threads, the calling thread taking the last share
+    vector<boost::thread> workers;
+    auto share=(n+threads-1)/threads;
+    for (size_t j=0; j+share<n; j+=share)
+      workers.emplace_back([=]{columns(j, j+share);});
+    columns(workers.size()*share, n);
+    for (auto& w: workers) w.join();
+  }
+}
@@ -0,0 +1,47 @@
+/*
+  @copyright Russell Standish 2021
+  @author Russell Standish
+  This file is part of Civita.
+
+  Civita is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Civita is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Civita.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CIVITA_CONTRACTION_H
+#define CIVITA_CONTRACTION_H
+#include "tensorInterface.h"
+#include <cstddef>
+
+namespace civita
+{
+  /// multiply-adds above which a contraction is shared between threads
+  constexpr std::size_t parallelContractionThreshold=1<<22;
+  
+  /// Contract the last dimension of \a a with the first dimension of
+  /// \a b, of any rank. With hypercube indices flattened, \a a is an
+  /// \a m×\a k column major matrix, \a b is \a k×\a n, and \a c
+  /// receives the dense \a m×\a n product. Missing (NaN) elements
+  /// are treated as zero. Sparse arguments are traversed via their
+  /// index, dense ones are multiplied with a cache blocked kernel.
+  /// @param threads number of threads to use, 0 for the hardware concurrency
+  /// if the work exceeds parallelContractionThreshold
+  void contract(std::size_t m, std::size_t k, std::size_t n,
+                const ITensor& a, const ITensor& b, double* c, unsigned threads=0);
+
+  /// dense kernel of contract: c=a·b for column major matrices, over
+  /// columns [\a j0,\a j1) of \a b and \a c
+  void gemm(std::size_t m, std::size_t k, const double* a, const double* b, double* c,
+            std::size_t j0, std::size_t j1);
+}
+
+#endif
@@ -67,6 +67,19 @@ namespace civita
     return r;
   }
   
+  vector<size_t> Hypercube::strides() const
+  {
+    vector<size_t> r;
+    r.reserve(xvectors.size());
+    size_t stride=1;
+    for (auto& i: xvectors)
+      {
+        r.push_back(stride);
+        stride*=i.size();
+      }
+    return r;
+  }
+  
   /// split lineal index into components along each dimension
   vector<size_t> Hypercube::splitIndex(size_t i) const
   {
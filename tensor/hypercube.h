@@ -71,6 +71,69 @@ namespace civita
         }
       return index;
     }
+    /// lineal index stride of each axis
+    std::vector<std::size_t> strides() const;
+  };
+
+  /// Split index of a hypercube position, maintained incrementally
+  /// as an odometer, rather than by splitIndex() on each step. Also
+  /// tracks the offset of the position into another hypercube, given
+  /// that hypercube's stride for each axis (eg a permutation of its
+  /// strides, or 0 for an axis being sliced away).
+  class MultiIndex
+  {
+    std::vector<std::size_t> m_dims, m_index, m_strides;
+    std::size_t m_lineal=0, m_offset=0;
+  public:
+    /// offset() defaults to the lineal index
+    explicit MultiIndex(const Hypercube& hc, std::size_t lineal=0):
+      m_index(hc.rank()), m_strides(hc.strides()) {
+      for (auto& i: hc.xvectors) m_dims.push_back(i.size());
+      seek(lineal);
+    }
+    /// set the strides used to compute offset()
+    void strides(std::vector<std::size_t> s) {
+      assert(s.size()==rank());
+      m_strides=std::move(s);
+      seek(m_lineal);
+    }
+    const std::vector<std::size_t>& strides() const {return m_strides;}
+    /// move to lineal index \a i. A hypercube with a zero length
+    /// axis has no positions, so its index stays at the origin.
+    void seek(std::size_t i) {
+      m_lineal=i; m_offset=0;
+      for (std::size_t k=0; k<rank(); ++k)
+        {
+          if (!m_dims[k])
+            {
+              for (auto& j: m_index) j=0;
+              m_offset=0;
+              return;
+            }
+          m_index[k]=i%m_dims[k];
+          i/=m_dims[k];
+          m_offset+=m_index[k]*m_strides[k];
+        }
+    }
+    /// advance to the next lineal index
+    MultiIndex& operator++() {
+      ++m_lineal;
+      for (std::size_t k=0; k<rank(); ++k)
+        {
+          m_offset+=m_strides[k];
+          if (++m_index[k]<m_dims[k]) break;
+          m_offset-=m_strides[k]*m_dims[k];
+          m_index[k]=0;
+        }
+      return *this;
+    }
+    std::size_t rank() const {return m_dims.size();}
+    /// component along axis \a k
+    std::size_t operator[](std::size_t k) const {return m_index[k];}
+    const std::vector<std::size_t>& splitIndex() const {return m_index;}
+    std::size_t lineal() const {return m_lineal;}
+    /// position in the hypercube described by strides()
+    std::size_t offset() const {return m_offset;}
   };
 }
 
@@ -20,15 +20,51 @@
 
 #include "index.h"
 #include <assert.h>
+#include <algorithm>
+#include <limits>
 using namespace std;
 
 namespace civita
 {
+  constexpr unsigned Index::blockBits;
+  constexpr size_t Index::blockMask;
+  constexpr size_t Index::compressionThreshold;
+  
+  namespace
+  {
+    template <class D>
+    size_t compressedOffset(const vector<size_t>& blockBase, const vector<D>& delta, size_t h)
+    {
+      // rank: last block starting at or before h, then search within the block
+      auto block=upper_bound(blockBase.begin(), blockBase.end(), h);
+      if (block==blockBase.begin()) return delta.size();
+      --block;
+      auto d=h-*block;
+      if (d>numeric_limits<D>::max()) return delta.size();
+      auto blockStart=delta.begin()+((block-blockBase.begin())<<Index::blockBits);
+      auto blockEnd=size_t(delta.end()-blockStart)>Index::blockMask? blockStart+Index::blockMask+1: delta.end();
+      auto lb=std::lower_bound(blockStart, blockEnd, D(d));
+      if (lb!=blockEnd && *lb==d)
+        return size_t(lb-delta.begin());
+      return delta.size();
+    }
+  }
+  
   size_t Index::linealOffset(size_t h) const
   {
+    if (!delta16.empty()) return compressedOffset(blockBase, delta16, h);
+    if (!delta32.empty()) return compressedOffset(blockBase, delta32, h);
     auto lb=std::lower_bound(index.begin(), index.end(), h);
     if (lb!=index.end() && *lb==h)
       return size_t(lb-index.begin());
     return index.size();
   }
+
+  bool Index::sorted() const
+  {
+    for (size_t i=1; i<size(); ++i)
+      if ((*this)[i-1]>=(*this)[i])
+        return false;
+    return true;
+  }
 }
@@ -19,10 +19,14 @@
 
 #ifndef CIVITA_INDEX_H
 #define CIVITA_INDEX_H
-#include <vector>
-#include <set>
-#include <map>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <set>
+#include <vector>
 
 #ifndef CLASSDESC_ACCESS
 #define CLASSDESC_ACCESS(x)
@@ -34,11 +38,68 @@ namespace civita
   class Index
     {
       std::vector<std::size_t> index; // sorted index vector
+      /// Large indices are stored compressed instead of in index, as
+      /// element i = blockBase[i>>blockBits]+delta16[i] (or delta32[i]),
+      /// using the narrowest delta type spanning every block.
+      std::vector<std::size_t> blockBase;
+      std::vector<std::uint16_t> delta16;
+      std::vector<std::uint32_t> delta32;
       CLASSDESC_ACCESS(Index);
+
+      /// @return bytes per element needed for the deltas of the \a n
+      /// sorted, unique indices [\a begin, \a end) from their block
+      /// base, or sizeof(size_t) if they should not be compressed
+      template <class I, class F>
+      static unsigned deltaSize(I begin, I end, std::size_t n, F value) {
+        if (n<compressionThreshold) return sizeof(std::size_t);
+        std::size_t span=0, base=0, i=0;
+        for (; begin!=end; ++begin, ++i)
+          {
+            if ((i&blockMask)==0) base=value(*begin);
+            span=std::max(span, value(*begin)-base);
+          }
+        if (span>std::numeric_limits<std::uint32_t>::max()) return sizeof(std::size_t);
+        if (span>std::numeric_limits<std::uint16_t>::max()) return sizeof(std::uint32_t);
+        return sizeof(std::uint16_t);
+      }
+      template <class I, class F>
+      void assign(I begin, I end, std::size_t n, F value) {
+        clear();
+        switch (deltaSize(begin, end, n, value))
+          {
+          case sizeof(std::uint16_t): fill(begin, end, n, delta16, value); break;
+          case sizeof(std::uint32_t): fill(begin, end, n, delta32, value); break;
+          default:
+            index.reserve(n);
+            for (; begin!=end; ++begin) index.push_back(value(*begin));
+            break;
+          }
+      }
+      template <class I, class D, class F>
+      void fill(I begin, I end, std::size_t n, std::vector<D>& delta, F value) {
+        blockBase.reserve((n>>blockBits)+1);
+        delta.reserve(n);
+        for (std::size_t i=0; begin!=end; ++begin, ++i)
+          {
+            if ((i&blockMask)==0) blockBase.push_back(value(*begin));
+            delta.push_back(value(*begin)-blockBase.back());
+          }
+      }
+      struct Identity {std::size_t operator()(std::size_t x) const {return x;}};
+      template <class K, class V> struct First
+      {std::size_t operator()(const std::pair<K,V>& x) const {return x.first;}};
     public:
+      /// number of elements sharing a block base in the compressed representation
+      static constexpr unsigned blockBits=8;
+      static constexpr std::size_t blockMask=(1<<blockBits)-1;
+      /// indices with fewer elements than this are stored uncompressed
+      static constexpr std::size_t compressionThreshold=1<<16;
+      
       Index() {}
       template <class T> explicit
       Index(const T& indices) {*this=indices;}
+      /// \a indices must be sorted and unique
+      explicit Index(std::vector<std::size_t>&& indices) {*this=std::move(indices);}
       Index(const Index&)=default;
       Index(Index&&)=default;
       Index& operator=(const Index&)=default;
@@ -47,29 +108,84 @@ namespace civita
       // can only assign ordered containers
       template <class T, class C, class A>
       Index& operator=(const std::set<T,C,A>& indices) {
-        index.clear(); index.reserve(indices.size());
-        for (auto& i: indices) index.push_back(i);
+        assign(indices.begin(), indices.end(), indices.size(), Identity());
         return *this;
       }
       template <class K, class V, class C, class A>
       Index& operator=(const std::map<K,V,C,A>& indices) {
-        index.clear(); index.reserve(indices.size());
-        for (auto& i: indices) index.push_back(i.first);
+        assign(indices.begin(), indices.end(), indices.size(), First<const K,V>());
+        return *this;
+      }
+      /// assign a vector of indices, which must be sorted and unique
+      Index& operator=(std::vector<std::size_t>&& indices) {
+        if (deltaSize(indices.begin(), indices.end(), indices.size(), Identity())<sizeof(std::size_t))
+          {
+            std::vector<std::size_t> tmp(std::move(indices));
+            assign(tmp.begin(), tmp.end(), tmp.size(), Identity());
+          }
+        else
+          {
+            clear();
+            index=std::move(indices);
+          }
         return *this;
       }
 
       /// return hypercube index corresponding to lineal index i 
-      std::size_t operator[](std::size_t i) const {return index.empty()? i: index[i];}
+      std::size_t operator[](std::size_t i) const {
+        if (!index.empty()) return index[i];
+        if (!delta16.empty()) return blockBase[i>>blockBits]+delta16[i];
+        if (!delta32.empty()) return blockBase[i>>blockBits]+delta32[i];
+        return i;
+      }
       // invariant, should always be true
-      bool sorted() const
-      {std::set<std::size_t> tmp(index.begin(), index.end()); return tmp.size()==index.size();}
-      bool empty() const {return index.empty();}
-      std::size_t size() const {return index.size();}
-      void clear() {index.clear();}
+      bool sorted() const;
+      bool empty() const {return size()==0;}
+      std::size_t size() const {return index.size()+delta16.size()+delta32.size();}
+      void clear() {index.clear(); blockBase.clear(); delta16.clear(); delta32.clear();}
+      /// true if stored in the compressed representation
+      bool compressed() const {return !blockBase.empty();}
+      /// bytes used to store the index
+      std::size_t memoryUsage() const {
+        return sizeof(std::size_t)*(index.capacity()+blockBase.capacity())+
+          sizeof(std::uint16_t)*delta16.capacity()+sizeof(std::uint32_t)*delta32.capacity();
+      }
       /// return the lineal index of hypercube index h, or size if not present 
       std::size_t linealOffset(std::size_t h) const;
-      std::vector<std::size_t>::const_iterator begin() const {return index.begin();}
-      std::vector<std::size_t>::const_iterator end() const {return index.end();}
+
+      /// iterates over the hypercube indices in order
+      class const_iterator
+      {
+        const Index* idx=nullptr;
+        std::size_t pos=0;
+      public:
+        using iterator_category=std::random_access_iterator_tag;
+        using value_type=std::size_t;
+        using difference_type=std::ptrdiff_t;
+        using pointer=const std::size_t*;
+        using reference=std::size_t;
+        const_iterator() {}
+        const_iterator(const Index& idx, std::size_t pos): idx(&idx), pos(pos) {}
+        std::size_t operator*() const {return (*idx)[pos];}
+        std::size_t operator[](difference_type i) const {return (*idx)[pos+i];}
+        const_iterator& operator++() {++pos; return *this;}
+        const_iterator operator++(int) {auto r=*this; ++pos; return r;}
+        const_iterator& operator--() {--pos; return *this;}
+        const_iterator operator--(int) {auto r=*this; --pos; return r;}
+        const_iterator& operator+=(difference_type i) {pos+=i; return *this;}
+        const_iterator& operator-=(difference_type i) {pos-=i; return *this;}
+        const_iterator operator+(difference_type i) const {auto r=*this; return r+=i;}
+        const_iterator operator-(difference_type i) const {auto r=*this; return r-=i;}
+        difference_type operator-(const const_iterator& x) const {return difference_type(pos)-difference_type(x.pos);}
+        bool operator==(const const_iterator& x) const {return pos==x.pos;}
+        bool operator!=(const const_iterator& x) const {return pos!=x.pos;}
+        bool operator<(const const_iterator& x) const {return pos<x.pos;}
+        bool operator>(const const_iterator& x) const {return pos>x.pos;}
+        bool operator<=(const const_iterator& x) const {return pos<=x.pos;}
+        bool operator>=(const const_iterator& x) const {return pos>=x.pos;}
+      };
+      const_iterator begin() const {return const_iterator(*this,0);}
+      const_iterator end() const {return const_iterator(*this,size());}
     };
     
 
@@ -31,21 +31,22 @@ namespace
         return false;
     return true;
   }
-}
-  
-namespace civita
-{
 
-  vector<size_t> InterpolateHC::splitAndRotate(size_t hcIndex) const
+  /// @return sum of weights times \a value of each index in [begin,end), or NaN if empty
+  template <class W, class V>
+  double weightedSum(const W* begin, const W* end, V value)
   {
-    vector<size_t> r(rank());
-    const auto& h=hypercube();
-    for (size_t dim=0; dim<rank(); ++dim)
-      r[rotation[dim]] = (hcIndex/strides[dim]) % h.xvectors[dim].size();
+    if (begin==end) return nan("");
+    double r=0;
+    for (; begin!=end; ++begin)
+      r+=begin->weight * value(begin->index);
     return r;
   }
-
+}
   
+namespace civita
+{
+
   void InterpolateHC::setArgument(const TensorPtr& a, const string&,double)
   {
     arg=a;
@@ -53,6 +54,8 @@ namespace civita
       throw runtime_error("Rank of interpolated tensor doesn't match its argument");
     // reorder hypercube for type and name
     interimHC.xvectors.clear();
+    sortedArgHC.clear();
+    strides.clear();
     size_t stride=1;
     const auto& targetHC=hypercube().xvectors;
     rotation.clear();
@@ -98,12 +101,29 @@ namespace civita
     for (auto& i: rotation) assert(i<rank()); // check that no indices have been doubly assigned.
     // Now we're sure rotation is a permutation
 #endif
-    if (index().empty())
-      for (size_t i=0; i<size(); ++i)
-        weightedIndices.push_back(bodyCentredNeighbourhood(i));
-    else
-      for (auto i: index())
-        weightedIndices.push_back(bodyCentredNeighbourhood(i));
+    targetAxis.resize(rank());
+    for (size_t i=0; i<rank(); ++i)
+      targetAxis[rotation[i]]=i;
+    computeAxisWeights();
+
+    // a sparse target only takes weights from neighbours in its index
+    weightedIndices.clear();
+    for (auto i: index())
+      {
+        neighbourhood(i, nbrs);
+        auto& entries=weightedIndices.entries;
+        auto start=entries.size();
+        double sumWeight=0;
+        for (auto& j: nbrs)
+          if (index().linealOffset(j.index)<index().size())
+            {
+              entries.push_back(j);
+              sumWeight+=j.weight;
+            }
+        for (auto k=entries.begin()+start; k!=entries.end(); ++k)
+          k->weight/=sumWeight;
+        weightedIndices.rows.push_back(entries.size());
+      }
   }
 
   void InterpolateHC::sortAndAdd(const XVector& xv)
@@ -123,45 +143,72 @@ namespace civita
   
   double InterpolateHC::operator[](size_t idx) const
   {
-    if (idx<weightedIndices.size())
+    if (idx>=size()) return nan("");
+    auto value=[this](size_t i) {
+      assert(i<arg->hypercube().numElements());
+      return arg->atHCIndex(i);
+    };
+    if (!index().empty())
       {
-        if (weightedIndices[idx].empty()) return nan("");
-        double r=0;
-        for (const auto& i: weightedIndices[idx])
-          {
-            assert(i.index<arg->hypercube().numElements());
-            r+=i.weight * arg->atHCIndex(i.index);
-          }
-        return r;
+        auto& w=weightedIndices;
+        return weightedSum(w.entries.data()+w.rows[idx], w.entries.data()+w.rows[idx+1], value);
+      }
+    neighbourhood(idx, nbrs);
+    return weightedSum(nbrs.data(), nbrs.data()+nbrs.size(), value);
+  }
+
+  void InterpolateHC::evaluate(double* r, size_t begin, size_t end) const
+  {
+    // fetch the argument in bulk if most of it is wanted
+    bool bulk=2*(end-begin)>=arg->size();
+    if (bulk)
+      {
+        argValues.resize(arg->size());
+        arg->evaluate(argValues.data(), 0, argValues.size());
       }
-    return nan("");
+    auto& argIndex=arg->index();
+    auto value=[&](size_t i) {
+      if (!bulk) return arg->atHCIndex(i);
+      if (argIndex.empty()) return argValues[i];
+      auto j=argIndex.linealOffset(i);
+      return j<argValues.size()? argValues[j]: nan("");
+    };
+
+    if (!index().empty())
+      {
+        auto& w=weightedIndices;
+        for (auto i=begin; i<end; ++i)
+          r[i-begin]=weightedSum(w.entries.data()+w.rows[i], w.entries.data()+w.rows[i+1], value);
+        return;
+      }
+    for (auto i=begin; i<end; ++i)
+      {
+        neighbourhood(i, nbrs);
+        r[i-begin]=weightedSum(nbrs.data(), nbrs.data()+nbrs.size(), value);
+      }
+  }
+
+  size_t InterpolateHC::memoryUsage() const
+  {
+    size_t r=weightedIndices.memoryUsage();
+    for (auto& i: axisWeights) r+=i.memoryUsage();
+    return r;
   }
 
-  InterpolateHC::WeightedIndexVector InterpolateHC::bodyCentredNeighbourhood(size_t destIdx) const
+  void InterpolateHC::computeAxisWeights()
   {
-    // note this agorithm is limited in rank (typically 32 dims on 32bit machine, or 64 dims on 64bit)
-    if (rank()>sizeof(size_t)*8)
-      throw runtime_error("Ranks > "+to_string(sizeof(size_t)*8)+" not supported");
-    size_t numNeighbours=size_t(1)<<rank();
-    vector<size_t> iIdx=splitAndRotate(destIdx);
     const auto& argHC=arg->hypercube();
-    // loop over the nearest neighbours in argument hypercube space of
-    // this point in interimHypercube space
-    double sumWeight=0;
-    WeightedIndexVector r;
-    auto argIndexVector=arg->index();
-    // multivariate interpolation - eg see Abramowitz & Stegun 25.2.66
-    for (size_t nbr=0; nbr<numNeighbours; ++nbr)
+    axisWeights.assign(rank(), {});
+    for (size_t dim=0, stride=1; dim<rank(); stride*=argHC.xvectors[dim].size(), ++dim)
       {
-        size_t argIdx=0;
-        double weight=1;
-        size_t idx=0;
-        for (size_t dim=0, stride=1; dim<rank(); stride*=argHC.xvectors[dim].size(), ++dim)
+        const auto& x=sortedArgHC[dim].first;
+        const auto& position=sortedArgHC[dim].second;
+        assert(!x.empty());
+        assert(sorted(x.begin(),x.end()));
+        auto& w=axisWeights[dim];
+        // multivariate interpolation - eg see Abramowitz & Stegun 25.2.66
+        for (auto& v: interimHC.xvectors[dim])
           {
-            const auto& x=sortedArgHC[dim].first;
-            assert(!x.empty());
-            assert(sorted(x.begin(),x.end()));
-            auto v=interimHC.xvectors[dim][iIdx[dim]];
             auto lesserIt=std::upper_bound(x.begin(), x.end(), v, AnyLess());
             if (lesserIt!=x.begin()) --lesserIt; // find greatest value <= v, 
             boost::any lesser=*lesserIt, greater;
@@ -172,35 +219,43 @@ namespace civita
             else
               greater=*(lesserIt+1);
 
-            bool greaterSide = nbr&(size_t(1)<<dim); // on higher side of hypercube
+            auto lesserPos=lesserIt-x.begin();
             double d=diff(greater,lesser);
-            if (d==0 && greaterSide) goto nextNeighbour; // already taken lesserVal at weight 1.
-
-            idx += sortedArgHC[dim].second[(lesserIt-x.begin()+greaterSide)]*stride;
-            assert(idx<argHC.numElements());
             if (d>0)
-              weight *= greaterSide? diff(v,lesser): d-diff(v,lesser);
-          }
-        if (index().empty())
-          {
-            r.emplace_back(WeightedIndex{idx,weight});
-            sumWeight+=weight;
-          }
-        else
-          {
-            auto indexV=index();
-            if (binary_search(indexV.begin(), indexV.end(), idx))
               {
-                r.emplace_back(WeightedIndex{idx,weight});
-                sumWeight+=weight;
+                w.entries.emplace_back(position[lesserPos]*stride, (d-diff(v,lesser))/d);
+                w.entries.emplace_back(position[lesserPos+1]*stride, diff(v,lesser)/d);
               }
+            else
+              w.entries.emplace_back(position[lesserPos]*stride, 1);
+            w.rows.push_back(w.entries.size());
           }
-      nextNeighbour:;
       }
+  }
 
-    // normalise weights
-    for (auto& i: r) i.weight/=sumWeight;
-    return r;
+  void InterpolateHC::neighbourhood(size_t idx, vector<WeightedIndex>& r) const
+  {
+    r.assign(1, WeightedIndex(0,1));
+    const auto& xv=hypercube().xvectors;
+    for (size_t dim=0; dim<rank(); ++dim)
+      {
+        auto t=targetAxis[dim];
+        auto& w=axisWeights[dim];
+        auto coord=(idx/strides[t]) % xv[t].size();
+        assert(coord+1<w.rows.size());
+        auto begin=w.entries.data()+w.rows[coord], end=w.entries.data()+w.rows[coord+1];
+        // form the product of the neighbourhood so far with dim's neighbours
+        auto n=r.size();
+        r.reserve(n*(end-begin));
+        for (auto j=begin+1; j<end; ++j)
+          for (size_t i=0; i<n; ++i)
+            r.emplace_back(r[i].index+j->index, r[i].weight*j->weight);
+        for (size_t i=0; i<n; ++i)
+          {
+            r[i].index+=begin->index;
+            r[i].weight*=begin->weight;
+          }
+      }
   }
 
 }
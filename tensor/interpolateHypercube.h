@@ -37,9 +37,6 @@ namespace civita
     std::vector<std::pair<XVector, std::vector<std::size_t>>> sortedArgHC;
     void sortAndAdd(const XVector&);
 
-    //
-    vector<std::size_t> splitAndRotate(std::size_t) const;
-    
     /// structure for referring to an argument index and its weight 
     struct WeightedIndex
     {
@@ -48,21 +45,41 @@ namespace civita
       WeightedIndex(std::size_t index,double weight): index(index), weight(weight) {}
     };
 
-    struct WeightedIndexVector: public vector<WeightedIndex>
+    /// Weights in compressed sparse row form. Row i's entries are
+    /// entries[rows[i]..rows[i+1]) 
+    struct WeightedIndexRows
     {
-      bool argIsOnDestHypercube=false;
+      std::vector<std::size_t> rows{0};
+      std::vector<WeightedIndex> entries;
+      void clear() {rows.assign(1,0); entries.clear();}
+      std::size_t memoryUsage() const
+      {return rows.capacity()*sizeof(rows[0])+entries.capacity()*sizeof(entries[0]);}
     };
-  
-    /// map from this tensor's index into the argument tensor
-    vector<WeightedIndexVector> weightedIndices;
 
-    /// computes the neighbourhood around a target argument index when
-    /// the target index is not on the hypercube
-    WeightedIndexVector bodyCentredNeighbourhood(std::size_t idx) const;
+    /// Interpolation is separable, so neighbourhoods are products of
+    /// 1D neighbourhoods. Row i of axisWeights[dim] gives the argument
+    /// offsets (coordinate × stride) and normalised weights of the
+    /// neighbours of coordinate i of interimHC along dim.
+    std::vector<WeightedIndexRows> axisWeights;
+    /// axis of this->hypercube() corresponding to each argument axis
+    std::vector<std::size_t> targetAxis;
+    void computeAxisWeights();
+
+    /// explicit neighbourhoods of each element of a sparse target
+    WeightedIndexRows weightedIndices;
+
+    /// computes the neighbourhood around target hypercube index \a
+    /// idx into \a r, with weights normalised
+    void neighbourhood(std::size_t idx, std::vector<WeightedIndex>& r) const;
+    mutable std::vector<WeightedIndex> nbrs; ///< workspace for neighbourhood
+    mutable std::vector<double> argValues;
 
   public:
     void setArgument(const TensorPtr& a, const string& ax="",double ag=0) override;
     double operator[](std::size_t) const override;
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
+    /// bytes used by precomputed interpolation weights
+    std::size_t memoryUsage() const;
     Timestamp timestamp() const override {return arg? arg->timestamp(): Timestamp();}
   };
   
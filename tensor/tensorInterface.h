@@ -25,7 +25,8 @@
 #ifndef CLASSDESC_ACCESS
 #define CLASSDESC_ACCESS(x)
 #endif
-#include <chrono>
+#include <atomic>
+#include <cstdint>
 #include <set>
 
 namespace civita
@@ -72,6 +73,12 @@ namespace civita
     virtual const Index& index() const {return m_index;}
     /// return or compute data at a location
     virtual double operator[](std::size_t) const=0;
+    /// evaluate elements [\a begin,\a end) into \a r, equivalent to
+    /// r[i-begin]=(*this)[i]. Overridden where a whole block can be
+    /// computed more cheaply than element by element
+    virtual void evaluate(double* r, std::size_t begin, std::size_t end) const {
+      for (auto i=begin; i<end; ++i) *r++=(*this)[i];
+    }
     /// return number of elements in tensor - maybe less than hypercube.numElements if sparse
     virtual std::size_t size() const {
       std::size_t s=index().size();
@@ -100,11 +107,19 @@ namespace civita
     double operator()(const std::initializer_list<T>& indices) const
     {return atHCIndex(hcIndex(indices));}
                        
-    using Timestamp=std::chrono::time_point<std::chrono::high_resolution_clock>;
-    /// timestamp indicating how old the dependendent data might
-    /// be. Used in CachedTensorOp to determine when to invalidate the
-    /// cache
+    /// logical timestamp: a version number drawn from a global
+    /// counter, so that later changes have larger timestamps. 0
+    /// represents data that never changes
+    using Timestamp=std::uint64_t;
+    /// timestamp of the most recent change to the dependendent
+    /// data. Used in CachedTensorOp to determine when to invalidate
+    /// the cache
     virtual Timestamp timestamp() const=0;
+    /// a timestamp later than all previously issued
+    static Timestamp newTimestamp() {
+      static std::atomic<Timestamp> clock{0};
+      return ++clock;
+    }
 
     /// arguments relevant for tensor expressions, not always meaningful. Exception thrown if not.
     virtual void setArgument(const TensorPtr&, const std::string& dimension={},
@@ -18,8 +18,12 @@
 */
 
 #include "tensorOp.h"
+#include <algorithm>
 #include <exception>
+#include <iterator>
 #include <set>
+// std::thread not supported on MXE
+#include <boost/thread.hpp>
 #include <ecolab_epilogue.h>
 using namespace std;
 
@@ -40,12 +44,174 @@ namespace civita
       hypercube(arg2->hypercube());
     else
       hypercube(Hypercube());
-    set<size_t> indices;
-    if (arg1) indices.insert(arg1->index().begin(), arg1->index().end());
-    if (arg2) indices.insert(arg2->index().begin(), arg2->index().end());
-    m_index=indices;
+    // union of the argument indices, which are sorted
+    static const Index empty;
+    auto& i1=arg1? arg1->index(): empty;
+    auto& i2=arg2? arg2->index(): empty;
+    vector<size_t> indices;
+    indices.reserve(max(i1.size(), i2.size()));
+    set_union(i1.begin(), i1.end(), i2.begin(), i2.end(), back_inserter(indices));
+    m_index=move(indices);
   }
 
+  namespace
+  {
+    /// reads an argument of a BinOp at increasing hypercube indices
+    class BinOpArg
+    {
+      const ITensor& arg;
+      const Index& index;
+      bool scalar;
+      size_t pos=0;
+    public:
+      BinOpArg(const ITensor& arg, size_t firstHCIndex):
+        arg(arg), index(arg.index()), scalar(arg.rank()==0) {
+        if (!index.empty())
+          pos=lower_bound(index.begin(), index.end(), firstHCIndex)-index.begin();
+      }
+      double operator()(size_t hcIndex) {
+        if (scalar) return arg[0];
+        if (index.empty())
+          return hcIndex<arg.size()? arg[hcIndex]: nan("");
+        while (pos<index.size() && index[pos]<hcIndex) ++pos;
+        return pos<index.size() && index[pos]==hcIndex? arg[pos]: nan("");
+      }
+    };
+
+    /// r[i-begin]=arg[argIndex[i]] for i in [begin,end), evaluating
+    /// all of arg in bulk if most of it is wanted
+    void gather(const ITensor& arg, const vector<size_t>& argIndex, double* r,
+                size_t begin, size_t end, vector<double>& argValues)
+    {
+      if (2*(end-begin)>=arg.size())
+        {
+          argValues.resize(arg.size());
+          arg.evaluate(argValues.data(), 0, argValues.size());
+          for (auto i=begin; i<end; ++i) *r++=argValues[argIndex[i]];
+        }
+      else
+        for (auto i=begin; i<end; ++i) *r++=arg[argIndex[i]];
+    }
+  }
+
+  void BinOp::evaluate(double* r, size_t begin, size_t end) const
+  {
+    if (begin>=end) return;
+    if (!arg1 || !arg2)
+      {
+        ITensor::evaluate(r,begin,end);
+        return;
+      }
+    auto& idx=index();
+    if (idx.empty())
+      {
+        // dense or scalar arguments of the same size: evaluate each in bulk
+        auto n=end-begin;
+        if (arg1->rank())
+          arg1->evaluate(r, begin, end);
+        else
+          fill(r, r+n, (*arg1)[0]);
+        scratch.resize(n);
+        if (arg2->rank())
+          arg2->evaluate(scratch.data(), begin, end);
+        else
+          fill(scratch.begin(), scratch.end(), (*arg2)[0]);
+        for (size_t i=0; i<n; ++i) r[i]=f(r[i], scratch[i]);
+        return;
+      }
+    BinOpArg a1(*arg1, idx[begin]), a2(*arg2, idx[begin]);
+    for (auto i=begin; i<end; ++i, ++r)
+      {
+        auto hcIndex=idx[i];
+        *r=f(a1(hcIndex), a2(hcIndex));
+      }
+  }
+
+
+  const size_t FusedElementWiseOp::blockSize;
+  
+  FusedElementWiseOp::FusedElementWiseOp(const TensorPtr& root): m_root(root)
+  {
+    if (root) compile(*root, 1);
+    stack.resize(stackDepth, vector<double>(blockSize));
+  }
+
+  size_t FusedElementWiseOp::fusableOps(const ITensor& t)
+  {
+    if (auto f=dynamic_cast<const FusedElementWiseOp*>(&t))
+      return fusableOps(*f->m_root);
+    if (auto e=dynamic_cast<const ElementWiseOp*>(&t))
+      if (e->arg)
+        return 1+fusableOps(*e->arg);
+    // a BinOp with empty index has scalar or dense conformal arguments
+    if (auto b=dynamic_cast<const BinOp*>(&t))
+      if (b->arg1 && b->arg2 && b->index().empty())
+        return 1+fusableOps(*b->arg1)+fusableOps(*b->arg2);
+    return 0;
+  }
+  
+  void FusedElementWiseOp::compile(const ITensor& t, size_t depth)
+  {
+    stackDepth=max(stackDepth, depth);
+    if (auto f=dynamic_cast<const FusedElementWiseOp*>(&t))
+      return compile(*f->m_root, depth);
+    if (auto e=dynamic_cast<const ElementWiseOp*>(&t))
+      if (e->arg)
+        {
+          compile(*e->arg, depth);
+          program.emplace_back();
+          program.back().unary=e->f;
+          return;
+        }
+    if (auto b=dynamic_cast<const BinOp*>(&t))
+      if (b->arg1 && b->arg2 && b->index().empty())
+        {
+          compile(*b->arg1, depth);
+          compile(*b->arg2, depth+1);
+          program.emplace_back();
+          program.back().binary=b->f;
+          return;
+        }
+    program.emplace_back();
+    program.back().leaf=&t;
+  }
+
+  void FusedElementWiseOp::evaluate(double* r, size_t begin, size_t end) const
+  {
+    if (program.empty())
+      {
+        fill(r, r+(end-begin), 0);
+        return;
+      }
+    for (auto b=begin; b<end; b+=blockSize)
+      {
+        auto n=min(blockSize, end-b);
+        size_t sp=0;
+        for (auto& i: program)
+          if (i.leaf)
+            {
+              auto x=stack[sp++].data();
+              if (i.leaf->rank())
+                i.leaf->evaluate(x, b, b+n);
+              else // scalars are broadcast
+                fill(x, x+n, (*i.leaf)[0]);
+            }
+          else if (i.unary)
+            {
+              auto x=stack[sp-1].data();
+              for (size_t j=0; j<n; ++j) x[j]=i.unary(x[j]);
+            }
+          else
+            {
+              --sp;
+              auto x=stack[sp-1].data(), y=stack[sp].data();
+              for (size_t j=0; j<n; ++j) x[j]=i.binary(x[j],y[j]);
+            }
+        assert(sp==1);
+        copy(stack[0].begin(), stack[0].begin()+n, r);
+        r+=n;
+      }
+  }
 
   void ReduceArguments::setArguments(const vector<TensorPtr>& a,const std::string&,double)
   {
@@ -82,7 +248,7 @@ namespace civita
 
   ITensor::Timestamp ReduceArguments::timestamp() const
   {
-    Timestamp t;
+    Timestamp t=0;
     for (const auto& i: args)
       t=max(t, i->timestamp());
     return t;
@@ -91,9 +257,11 @@ namespace civita
   double ReduceAllOp::operator[](size_t) const
   {
     double r=init;
-    for (size_t i=0; i<arg->size(); ++i)
+    argValues.resize(arg->size());
+    arg->evaluate(argValues.data(), 0, argValues.size());
+    for (size_t i=0; i<argValues.size(); ++i)
       {
-        double x=(*arg)[i];
+        double x=argValues[i];
         if (!isnan(x)) f(r,x,i);
       }
     return r;
@@ -103,82 +271,122 @@ namespace civita
   {
     arg=a;
     dimension=std::numeric_limits<size_t>::max();
-    if (arg)
+    stride=dimSize=1;
+    offsets.clear();
+    entries.clear();
+    m_index=Index();
+    if (!arg)
+      {
+        m_hypercube.xvectors.clear();
+        return;
+      }
+    const auto& ahc=arg->hypercube();
+    m_hypercube=ahc;
+    auto& xv=m_hypercube.xvectors;
+    for (auto i=xv.begin(); i!=xv.end(); ++i)
+      if (i->name==dimName)
+        dimension=i-xv.begin();
+    if (dimension>=arg->rank())
+      {
+        xv.clear(); //reduce all, return scalar
+        return;
+      }
+    auto argDims=ahc.dims();
+    for (size_t j=0; j<dimension; ++j)
+      stride*=argDims[j];
+    dimSize=argDims[dimension];
+    xv.erase(xv.begin()+dimension);
+
+    // sparse plan: sort the argument elements by the element they are
+    // reduced into. Stable, so each element's entries remain in
+    // dimIndex order
+    auto& argIndex=arg->index();
+    vector<pair<size_t,SOI>> reducedInto;
+    reducedInto.reserve(argIndex.size());
+    for (size_t i=0; i<argIndex.size(); ++i)
       {
-        const auto& ahc=arg->hypercube();
-        m_hypercube=ahc;
-        auto& xv=m_hypercube.xvectors;
-        for (auto i=xv.begin(); i!=xv.end(); ++i)
-          if (i->name==dimName)
-            dimension=i-xv.begin();
-        if (dimension<arg->rank())
+        auto quotRem=ldiv(argIndex[i], stride);
+        auto dimQuotRem=ldiv(quotRem.quot, dimSize);
+        reducedInto.emplace_back(quotRem.rem+stride*dimQuotRem.quot, SOI{i,size_t(dimQuotRem.rem)});
+      }
+    stable_sort(reducedInto.begin(), reducedInto.end(),
+                [](const pair<size_t,SOI>& x, const pair<size_t,SOI>& y) {return x.first<y.first;});
+    vector<size_t> indices;
+    for (auto& i: reducedInto)
+      {
+        if (indices.empty() || indices.back()!=i.first)
           {
-            xv.erase(xv.begin()+dimension);
-            // compute index - enter index elements that have any in the argument
-            set<size_t> indices;
-            for (size_t i=0; i<arg->size(); ++i)
-              {
-                auto splitIdx=ahc.splitIndex(arg->index()[i]);
-                SOI soi{i,splitIdx[dimension]};
-                splitIdx.erase(splitIdx.begin()+dimension);
-                auto idx=m_hypercube.linealIndex(splitIdx);
-                sumOverIndices[idx].emplace_back(soi);
-                indices.insert(idx);
-              }
-            m_index=indices;
+            indices.push_back(i.first);
+            offsets.push_back(entries.size());
           }
-        else
-          m_hypercube.xvectors.clear(); //reduce all, return scalar
+        entries.push_back(i.second);
       }
-    else
-      m_hypercube.xvectors.clear();
+    if (!entries.empty())
+      offsets.push_back(entries.size());
+    m_index=move(indices);
   }
 
+  const double* ReductionOp::argumentValues(size_t begin, size_t end) const
+  {
+    // reading the whole argument only pays if most of the result is wanted
+    if (!arg || 2*(end-begin)<size()) return nullptr;
+    argValues.resize(arg->size());
+    arg->evaluate(argValues.data(), 0, argValues.size());
+    return argValues.data();
+  }
   
-  double ReductionOp::operator[](size_t i) const
+  void ReductionOp::reduce(double* r, size_t begin, size_t end, const Reduce& g, double init,
+                           const double* values, size_t* counts) const
   {
-    assert(i<size());
-    if (!arg) return init;
-    if (dimension>arg->rank())
-      return ReduceAllOp::operator[](i);
+    fill(r, r+(end-begin), init);
+    if (counts) fill(counts, counts+(end-begin), 0);
+    if (!arg) return;
+    auto accumulate=[&](size_t i, double x, size_t dimIndex) {
+      if (!isnan(x))
+        {
+          g(r[i],x,dimIndex);
+          if (counts) ++counts[i];
+        }
+    };
+    auto argValue=[&](size_t i) {return values? values[i]: (*arg)[i];};
 
-    double r=init;
-    if (index().empty())
+    if (!offsets.empty())
       {
-        auto argDims=arg->shape();
-        size_t stride=1;
-        for (size_t j=0; j<dimension; ++j)
-          stride*=argDims[j];
-        auto quotRem=ldiv(i, stride); // quotient and remainder calc in one hit
-        auto start=quotRem.quot*stride*argDims[dimension] + quotRem.rem;
-        assert(stride*argDims[dimension]>0);
-        for (size_t j=0; j<argDims[dimension]; ++j)
-          {
-            double x=arg->atHCIndex(j*stride+start);
-            if (!isnan(x)) f(r,x,j);
-          }
+        for (auto i=begin; i<end; ++i)
+          for (auto j=offsets[i]; j<offsets[i+1]; ++j)
+            accumulate(i-begin, argValue(entries[j].index), entries[j].dimIndex);
+        return;
       }
-    else
-      {
-        auto soi=sumOverIndices.find(index()[i]);
-        assert(soi!=sumOverIndices.end());
-        if (soi!=sumOverIndices.end())
-          for (auto j: soi->second)
+    
+    // dense, or reduce all, in which case argument elements are
+    // indexed by their position rather than hypercube index
+    auto n=dimension<arg->rank()? dimSize: arg->size();
+    if (values && !sequential && stride>1)
+      // unit stride pass over the argument, interleaving the reductions
+      for (auto q=begin/stride; q*stride<end; ++q)
+        {
+          auto lo=max(begin, q*stride), hi=min(end, (q+1)*stride);
+          for (size_t j=0; j<n; ++j)
             {
-              double x=(*arg)[j.index];
-              if (!isnan(x)) f(r,x,j.dimIndex);
+              auto v=values+(q*n+j)*stride-q*stride;
+              for (auto i=lo; i<hi; ++i)
+                accumulate(i-begin, v[i], j);
             }
-      }
-    return r;
+        }
+    else // one element at a time, which is unit stride if stride==1
+      for (auto i=begin; i<end; ++i)
+        {
+          auto quotRem=ldiv(i, stride);
+          auto start=quotRem.quot*stride*n + quotRem.rem;
+          for (size_t j=0; j<n; ++j)
+            accumulate(i-begin, argValue(start+j*stride), j);
+        }
   }
 
   double CachedTensorOp::operator[](size_t i) const
   {
     assert(i<size());
-    if (m_timestamp<timestamp()) {
-      computeTensor();
-      m_timestamp=Timestamp::clock::now();
-    }
+    updateCache();
     return cachedResult[i];
   }
 
@@ -186,6 +394,7 @@ namespace civita
   {
     arg=a;
     argVal=av;
+    invalidateCache();
     if (!arg) {m_hypercube.xvectors.clear(); return;}
     dimension=std::numeric_limits<size_t>::max();
     auto hc=arg->hypercube();
@@ -197,48 +406,69 @@ namespace civita
   }
 
   
+  const vector<double>& DimensionedArgCachedOp::denseArgument() const
+  {
+    auto& idx=arg->index();
+    if (idx.empty())
+      {
+        argValues.resize(arg->size());
+        arg->evaluate(argValues.data(), 0, argValues.size());
+        return argValues;
+      }
+    vector<double> values(arg->size());
+    arg->evaluate(values.data(), 0, values.size());
+    argValues.assign(arg->hypercube().numElements(), nan(""));
+    size_t j=0;
+    for (auto i: idx)
+      argValues[i]=values[j++];
+    return argValues;
+  }
+  
   void Scan::computeTensor() const
   {
+    auto& values=denseArgument();
+    if (values.empty()) return;
+    auto r=&cachedResult[0];
+    // lanes of n elements, separated by stride
+    size_t n=values.size(), stride=1, window=n;
     if (dimension<rank())
       {
         auto argDims=arg->hypercube().dims();
-        size_t stride=1;
         for (size_t j=0; j<dimension; ++j)
           stride*=argDims[j];
-        if (argVal>=1 && argVal<argDims[dimension])
-          // argVal is interpreted as the binning window. -ve argVal ignored
-          for (size_t i=0; i<hypercube().numElements(); i+=stride*argDims[dimension])
-            for (size_t j=0; j<stride; ++j)
-              for (size_t j1=0; j1<argDims[dimension]*stride; j1+=stride)
-                {
-                  size_t k=i+j+max(ssize_t(0), ssize_t(j1-ssize_t(argVal-1)*stride));
-                  cachedResult[i+j+j1]=arg->atHCIndex(i+j+j1);
-                  for (; k<i+j+j1; k+=stride)
-                    {
-                      f(cachedResult[i+j+j1], arg->atHCIndex(k), k);
-                    }
-              }
-        else // scan over whole dimension
-          for (size_t i=0; i<hypercube().numElements(); i+=stride*argDims[dimension])
-            for (size_t j=0; j<stride; ++j)
-              {
-                cachedResult[i+j]=arg->atHCIndex(i+j);
-                for (size_t k=i+j+stride; k<i+j+stride*argDims[dimension]; k+=stride)
-                  {
-                    cachedResult[k] = cachedResult[k-stride];
-                    f(cachedResult[k], arg->atHCIndex(k), k);
-                  }
-              }
-          }
-    else
+        n=argDims[dimension];
+        // argVal is interpreted as the binning window. -ve argVal ignored
+        if (argVal>=1 && argVal<n)
+          window=size_t(argVal);
+      }
+
+    // share out blocks of adjacent lanes
+    const size_t blockWidth=min<size_t>(stride, 256);
+    const size_t blocksPerSlab=(stride+blockWidth-1)/blockWidth;
+    const size_t numBlocks=values.size()/(n*stride)*blocksPerSlab;
+    auto scanBlocks=[&](size_t b0, size_t b1) {
+      for (auto b=b0; b<b1; ++b)
+        {
+          auto slab=b/blocksPerSlab, lane=b%blocksPerSlab*blockWidth;
+          auto k0=slab*n*stride+lane;
+          kernel(r+k0, values.data()+k0, n, stride, min(blockWidth, stride-lane), window, k0);
+        }
+    };
+
+    size_t threads=values.size()>parallelScanThreshold? max(1u, boost::thread::hardware_concurrency()): 1;
+    threads=min(threads, numBlocks);
+    if (threads<=1)
       {
-        cachedResult[0]=arg->atHCIndex(0);
-        for (size_t i=1; i<hypercube().numElements(); ++i)
-          {
-            cachedResult[i]=cachedResult[i-1];
-            f(cachedResult[i], arg->atHCIndex(i), i);
-          }
+        scanBlocks(0, numBlocks);
+        return;
       }
+    // the calling thread takes the last share
+    vector<boost::thread> workers;
+    auto share=(numBlocks+threads-1)/threads;
+    for (size_t b=0; b+share<numBlocks; b+=share)
+      workers.emplace_back([=]{scanBlocks(b, b+share);});
+    scanBlocks(workers.size()*share, numBlocks);
+    for (auto& w: workers) w.join();
   }
 
   void Slice::setArgument(const TensorPtr& a,const string& axis, double index)
@@ -274,24 +504,31 @@ namespace civita
             hc.xvectors.push_back(*i);
         hypercube(hc);
 
-        // set up index vector
-        auto& ahc=arg->hypercube();
-        map<size_t, size_t> ai;
-        for (size_t i=0; i<arg->index().size(); ++i)
+        // set up index vector. Slicing preserves the order of the
+        // remaining elements, so no sorting is required
+        auto& argIndex=arg->index();
+        arg_index.clear();
+        if (!argIndex.empty())
           {
-            auto splitIdx=ahc.splitIndex(arg->index()[i]);
-            if (splitIdx[splitAxis]==sliceIndex)
+            MultiIndex idx(arg->hypercube());
+            auto strides=hc.strides();
+            if (splitAxis<idx.rank())
+              strides.insert(strides.begin()+splitAxis, 0);
+            idx.strides(move(strides));
+            vector<size_t> index;
+            for (size_t i=0; i<argIndex.size(); ++i)
               {
-                splitIdx.erase(splitIdx.begin()+splitAxis);
-                auto l=hc.linealIndex(splitIdx);
-                ai[l]=i;
+                idx.seek(argIndex[i]);
+                if (splitAxis>=idx.rank() || idx[splitAxis]==sliceIndex)
+                  {
+                    index.push_back(idx.offset());
+                    arg_index.push_back(i);
+                  }
               }
+            m_index=move(index);
           }
-        m_index=ai;
-        arg_index.resize(ai.size());
-        // convert into lineal addressing
-        size_t j=0;
-        for (auto& i: ai) arg_index[j++]=i.second;
+        else
+          m_index.clear();
       }
   }
 
@@ -305,6 +542,33 @@ namespace civita
       }
     return (*arg)[arg_index[i]];
   }
+
+  void Slice::evaluate(double* r, size_t begin, size_t end) const
+  {
+    if (!m_index.empty())
+      {
+        gather(*arg, arg_index, r, begin, end, argValues);
+        return;
+      }
+    // copying runs of split contiguous argument elements only pays if
+    // the runs are long
+    if (!arg->index().empty() || split<16)
+      {
+        ITensor::evaluate(r,begin,end);
+        return;
+      }
+    for (auto i=begin; i<end;)
+      {
+        auto res=ldiv(i, split);
+        size_t n=min(end-i, split-res.rem);
+        auto start=res.quot*stride + sliceIndex*split + res.rem;
+        if (start+n<=arg->size())
+          arg->evaluate(r, start, start+n);
+        else
+          for (size_t j=0; j<n; ++j) r[j]=arg->atHCIndex(start+j);
+        r+=n; i+=n;
+      }
+  }
   
   void Pivot::setArgument(const TensorPtr& a,const std::string&,double)
   {
@@ -351,46 +615,172 @@ namespace civita
 
     assert(hc.rank()==arg->rank());
     hypercube(move(hc));
+    materialised.invalidate();
+    // argument strides of each of this's axes
+    auto argStrides=ahc.strides();
+    strides.resize(permutation.size());
+    for (size_t k=0; k<permutation.size(); ++k)
+      strides[k]=argStrides[permutation[k]];
+    
     // permute the index vector
-    map<size_t, size_t> pi;
-    for (size_t i=0; i<arg->index().size(); ++i)
+    auto& argIndex=arg->index();
+    vector<pair<size_t, size_t>> pi;
+    pi.reserve(argIndex.size());
+    if (!argIndex.empty())
       {
-        auto idx=arg->hypercube().splitIndex(arg->index()[i]);
-        auto pidx=idx;
-        for (size_t j=0; j<idx.size(); ++j)
+        MultiIndex idx(ahc);
+        vector<size_t> pStrides(invPermutation.size());
+        auto hcStrides=hypercube().strides();
+        for (auto& i: invPermutation)
+          pStrides[i.first]=hcStrides[i.second];
+        idx.strides(move(pStrides));
+        for (size_t i=0; i<argIndex.size(); ++i)
           {
-            assert(invPermutation.count(j));
-            assert(invPermutation[j]<pidx.size());
-            pidx[invPermutation[j]]=idx[j];
+            idx.seek(argIndex[i]);
+            pi.emplace_back(idx.offset(), i);
           }
-        auto l=hypercube().linealIndex(pidx);
-        assert(pi.count(l)==0);
-        pi[l]=i;
+        sort(pi.begin(), pi.end());
       }
-    m_index=pi;
-    // convert to lineal indexing
+    vector<size_t> index;
+    index.reserve(pi.size());
     permutedIndex.clear();
-    for (auto& i: pi) permutedIndex.push_back(i.second);
+    for (auto& i: pi)
+      {
+        assert(index.empty() || index.back()<i.first);
+        index.push_back(i.first);
+        permutedIndex.push_back(i.second);
+      }
+    m_index=move(index);
     if (!permutedIndex.empty()) permutation.clear(); // not used in sparse case
   }
 
   size_t Pivot::pivotIndex(size_t i) const
   {
-    auto idx=hypercube().splitIndex(i);
-    auto pidx=idx;
-    for (size_t i=0; i<idx.size(); ++i)
-      pidx[permutation[i]]=idx[i];
-    return arg->hypercube().linealIndex(pidx);
+    size_t r=0;
+    auto& xv=hypercube().xvectors;
+    for (size_t k=0; k<strides.size(); ++k)
+      {
+        auto n=xv[k].size();
+        r+=(i%n)*strides[k];
+        i/=n;
+      }
+    return r;
   }
 
   double Pivot::operator[](size_t i) const
   {
     assert(i<size());
+    if (!materialised.values.empty() && materialised.current(arg->timestamp(), size()))
+      return materialised.values[i];
     if (index().empty())
       return arg->atHCIndex(pivotIndex(i));
     return (*arg)[permutedIndex[i]];
   }
 
+  void Pivot::evaluate(double* r, size_t begin, size_t end) const
+  {
+    if (begin>=end) return;
+    if (2*(end-begin)<size())
+      {
+        permute(r, begin, end);
+        return;
+      }
+    auto t=arg->timestamp();
+    if (!materialised.current(t, size()))
+      {
+        materialised.values.resize(size());
+        permute(materialised.values.data(), 0, size());
+        materialised.timestamp=t;
+      }
+    copy(materialised.values.begin()+begin, materialised.values.begin()+end, r);
+  }
+  
+  void Pivot::permute(double* r, size_t begin, size_t end) const
+  {
+    if (!index().empty())
+      {
+        gather(*arg, permutedIndex, r, begin, end, argValues);
+        return;
+      }
+
+    const double* values=nullptr;
+    if (arg->index().empty() && 2*(end-begin)>=arg->size())
+      {
+        argValues.resize(arg->size());
+        arg->evaluate(argValues.data(), 0, argValues.size());
+        values=argValues.data();
+      }
+    if (values && begin==0 && end==size())
+      {
+        transpose(values, r);
+        return;
+      }
+        
+    MultiIndex idx(hypercube());
+    idx.strides(strides);
+    idx.seek(begin);
+    for (auto i=begin; i<end; ++i, ++r, ++idx)
+      *r=values? values[idx.offset()]: arg->atHCIndex(idx.offset());
+  }
+
+  void Pivot::transpose(const double* values, double* r) const
+  {
+    auto& xv=hypercube().xvectors;
+    // axis of this that is the argument's contiguous axis
+    size_t b=find(permutation.begin(), permutation.end(), 0)-permutation.begin();
+    if (b==0 || b>=xv.size())
+      {
+        // already contiguous in both
+        MultiIndex idx(hypercube());
+        idx.strides(strides);
+        for (size_t i=0; i<size(); ++i, ++idx)
+          r[i]=values[idx.offset()];
+        return;
+      }
+    
+    // transpose axes 0 and b in tiles, for each position along the other axes
+    size_t na=xv[0].size(), nb=xv[b].size(), argStrideA=strides[0], strideB=1;
+    vector<size_t> dims, outStrides, argStrides;
+    for (size_t k=0, s=1; k<xv.size(); s*=xv[k++].size())
+      if (k==b)
+        strideB=s;
+      else if (k>0)
+        {
+          dims.push_back(xv[k].size());
+          outStrides.push_back(s);
+          argStrides.push_back(strides[k]);
+        }
+    static const size_t tile=32;
+    vector<size_t> idx(dims.size());
+    size_t outOffset=0, argOffset=0;
+    for (;;)
+      {
+        for (size_t j0=0; j0<nb; j0+=tile)
+          for (size_t i0=0; i0<na; i0+=tile)
+            {
+              auto jEnd=min(nb, j0+tile), iEnd=min(na, i0+tile);
+              for (size_t j=j0; j<jEnd; ++j)
+                {
+                  auto out=r+outOffset+j*strideB;
+                  auto in=values+argOffset+j;
+                  for (size_t i=i0; i<iEnd; ++i)
+                    out[i]=in[i*argStrideA];
+                }
+            }
+        // advance the odometer over the other axes
+        size_t k=0;
+        for (; k<dims.size(); ++k)
+          {
+            outOffset+=outStrides[k];
+            argOffset+=argStrides[k];
+            if (++idx[k]<dims[k]) break;
+            outOffset-=outStrides[k]*dims[k];
+            argOffset-=argStrides[k]*dims[k];
+            idx[k]=0;
+          }
+        if (k==dims.size()) break;
+      }
+  }
   
   namespace
   {
@@ -413,6 +803,7 @@ namespace civita
   void PermuteAxis::setArgument(const TensorPtr& a,const std::string& axisName,double)
   {
     arg=a;
+    materialised.invalidate();
     hypercube(arg->hypercube());
     m_index=arg->index();
     for (m_axis=0; m_axis<m_hypercube.xvectors.size(); ++m_axis)
@@ -427,39 +818,122 @@ namespace civita
   void PermuteAxis::setPermutation(vector<size_t>&& p)
   {
     m_permutation=move(p);
+    materialised.invalidate();
     auto& xv=m_hypercube.xvectors[m_axis];
     xv.clear();
     auto& axv=arg->hypercube().xvectors[m_axis];
     for (auto i: m_permutation)
       xv.push_back(axv[i]);
-    map<unsigned,unsigned> reverseIndex;
+    // position along the axis of each argument label, or size() if dropped
+    vector<size_t> reverseIndex(axv.size(), m_permutation.size());
     for (size_t i=0; i<m_permutation.size(); ++i)
-      reverseIndex[m_permutation[i]]=i;
-    map<size_t,size_t> indices;
-    for (size_t i=0; i<arg->index().size(); ++i)
+      if (m_permutation[i]<reverseIndex.size())
+        reverseIndex[m_permutation[i]]=i;
+    auto& argIndex=arg->index();
+    vector<pair<size_t,size_t>> indices;
+    indices.reserve(argIndex.size());
+    if (!argIndex.empty())
       {
-        auto splitted=arg->hypercube().splitIndex(arg->index()[i]);
-        auto ri=reverseIndex.find(splitted[m_axis]);
-        if (ri!=reverseIndex.end() && (splitted[m_axis]=ri->second)<axv.size())
-          indices[hypercube().linealIndex(splitted)]=i;
+        // offset into this of the argument element, apart from the permuted axis
+        MultiIndex idx(arg->hypercube());
+        auto strides=hypercube().strides();
+        auto axisStride=strides[m_axis];
+        strides[m_axis]=0;
+        idx.strides(move(strides));
+        for (size_t i=0; i<argIndex.size(); ++i)
+          {
+            idx.seek(argIndex[i]);
+            auto ri=reverseIndex[idx[m_axis]];
+            if (ri<m_permutation.size())
+              indices.emplace_back(idx.offset()+ri*axisStride, i);
+          }
+        sort(indices.begin(), indices.end());
       }
-    m_index=indices;
+    vector<size_t> index;
+    index.reserve(indices.size());
     permutedIndex.clear();
-    for (auto& i: indices) permutedIndex.push_back(i.second);
+    for (auto& i: indices)
+      {
+        index.push_back(i.first);
+        permutedIndex.push_back(i.second);
+      }
+    m_index=move(index);
   }
   
   double PermuteAxis::operator[](size_t i) const
   {
     assert(i<size());
+    if (!materialised.values.empty() && materialised.current(arg->timestamp(), size()))
+      return materialised.values[i];
     if (index().empty())
       {
-        auto splitted=hypercube().splitIndex(i);
-        splitted[m_axis]=m_permutation[splitted[m_axis]];
-        return arg->atHCIndex(arg->hypercube().linealIndex(splitted));
+        auto& xv=hypercube().xvectors;
+        size_t stride=1;
+        for (size_t k=0; k<m_axis; ++k)
+          stride*=xv[k].size();
+        auto res=ldiv(i, stride);
+        size_t n=xv[m_axis].size(), argN=arg->hypercube().xvectors[m_axis].size();
+        return arg->atHCIndex(res.rem + (m_permutation[res.quot%n] + res.quot/n*argN)*stride);
       }
     return (*arg)[permutedIndex[i]];
   }
 
+  void PermuteAxis::evaluate(double* r, size_t begin, size_t end) const
+  {
+    if (begin>=end) return;
+    if (2*(end-begin)<size())
+      {
+        permute(r, begin, end);
+        return;
+      }
+    auto t=arg->timestamp();
+    if (!materialised.current(t, size()))
+      {
+        materialised.values.resize(size());
+        permute(materialised.values.data(), 0, size());
+        materialised.timestamp=t;
+      }
+    copy(materialised.values.begin()+begin, materialised.values.begin()+end, r);
+  }
+  
+  void PermuteAxis::permute(double* r, size_t begin, size_t end) const
+  {
+    if (!index().empty())
+      {
+        gather(*arg, permutedIndex, r, begin, end, argValues);
+        return;
+      }
+    if (!arg->index().empty())
+      {
+        ITensor::evaluate(r,begin,end);
+        return;
+      }
+    // elements below the permuted axis are contiguous in both this and arg
+    auto& dims=hypercube().xvectors;
+    size_t stride=1;
+    for (size_t k=0; k<m_axis; ++k)
+      stride*=dims[k].size();
+    size_t n=dims[m_axis].size(), argN=arg->hypercube().xvectors[m_axis].size();
+    // short runs are better copied from the evaluated argument
+    const double* values=nullptr;
+    if (stride<16 && 2*(end-begin)>=arg->size())
+      {
+        argValues.resize(arg->size());
+        arg->evaluate(argValues.data(), 0, argValues.size());
+        values=argValues.data();
+      }
+    for (auto i=begin; i<end;)
+      {
+        auto res=ldiv(i, stride);
+        auto start=res.rem + (m_permutation[res.quot%n] + res.quot/n*argN)*stride;
+        auto len=min(end-i, stride-res.rem);
+        if (values)
+          copy(values+start, values+start+len, r);
+        else
+          arg->evaluate(r, start, start+len);
+        r+=len; i+=len;
+      }
+  }
 
   void SortByValue::computeTensor() const 
   {
@@ -494,107 +968,166 @@ namespace civita
   }
 
   
-  vector<TensorPtr> createRavelChain(const ravel::RavelState& state, const TensorPtr& arg)
+  namespace
   {
-    set<string> outputHandles(state.outputHandles.begin(), state.outputHandles.end());
-    vector<TensorPtr> chain{arg};
-    // TODO sorts and calipers
-    for (auto& i: state.handleStates)
-      {
-        if (i.order!=ravel::HandleSort::none || i.displayFilterCaliper)
+    /// permutation of \a xv implementing handle state \a h's sort order and calipers
+    vector<size_t> handlePermutation(const ravel::HandleState& h, const XVector& xv)
+    {
+      vector<size_t> perm;
+      switch (h.order)
         {
-          //apply sorting/calipers
-          auto permuteAxis=make_shared<PermuteAxis>();
-          permuteAxis->setArgument(chain.back(), i.description);
-          auto& xv=chain.back()->hypercube().xvectors[permuteAxis->axis()];
-          vector<size_t> perm;
-          for (size_t i=0; i<xv.size(); ++i)
-            perm.push_back(i);
-          switch (i.order)
-            {
-            case ravel::HandleSort::none: break;
-            case ravel::HandleSort::forward:
-            case ravel::HandleSort::numForward:
-            case ravel::HandleSort::timeForward:
-              sort(perm.begin(), perm.end(),
-                   [&](size_t i, size_t j) {return diff(xv[i],xv[j])<0;});
-              break;
-            case ravel::HandleSort::reverse:
-            case ravel::HandleSort::numReverse:
-            case ravel::HandleSort::timeReverse:
-              sort(perm.begin(), perm.end(),
-                   [&](size_t i, size_t j) {return diff(xv[i],xv[j])>0;});
-              break;
-            case ravel::HandleSort::custom:
-              {
-                map<string, size_t> offsets;
-                for (size_t i=0; i<xv.size(); ++i)
-                  offsets[str(xv[i], xv.dimension.units)]=i;
-                perm.clear();
-                for (auto& j: i.customOrder)
-                  if (offsets.count(j))
-                    perm.push_back(offsets[j]);
-                break;
-              }
-//            case ravel::HandleSort::numForward: case ravel::HandleSort::numReverse:
-//            case ravel::HandleSort::timeForward: case ravel::HandleSort::timeReverse:
-//              throw runtime_error("deprecated sort order used");
-            }
-          if (i.displayFilterCaliper)
+        case ravel::HandleSort::forward:
+        case ravel::HandleSort::numForward:
+        case ravel::HandleSort::timeForward:
+          perm=LabelColumn(xv).sortPermutation();
+          break;
+        case ravel::HandleSort::reverse:
+        case ravel::HandleSort::numReverse:
+        case ravel::HandleSort::timeReverse:
+          perm=LabelColumn(xv).sortPermutation(true);
+          break;
+        case ravel::HandleSort::custom:
+          for (auto& j: h.customOrder)
             {
-              // remove any permutation items outside calipers
-              if (!i.minLabel.empty())
-                for (auto j=perm.begin(); j!=perm.end(); ++j)
-                  if (str(xv[*j],xv.dimension.units) == i.minLabel)
-                    {
-                      perm.erase(perm.begin(), j);
-                      break;
-                    }
-              if (!i.maxLabel.empty())
-                for (auto j=perm.begin(); j!=perm.end(); ++j)
-                  if (str(xv[*j],xv.dimension.units) == i.maxLabel)
-                    {
-                      perm.erase(j+1, perm.end());
-                      break;
-                    }
+              auto offset=xv.offset(j);
+              if (offset<xv.size())
+                perm.push_back(offset);
             }
-          permuteAxis->setPermutation(move(perm));
-          chain.push_back(permuteAxis);
+          break;
+        default:
+          for (size_t i=0; i<xv.size(); ++i)
+            perm.push_back(i);
+          break;
         }
-      if (!outputHandles.count(i.description))
+      if (h.displayFilterCaliper)
         {
-          auto arg=chain.back();
-          if (i.collapsed)
+          // remove any permutation items outside calipers
+          if (!h.minLabel.empty())
             {
-              chain.emplace_back(createReductionOp(i.reductionOp));
-              chain.back()->setArgument(arg, i.description);
+              auto j=find(perm.begin(), perm.end(), xv.offset(h.minLabel));
+              if (j!=perm.end())
+                perm.erase(perm.begin(), j);
             }
-          else
+          if (!h.maxLabel.empty())
             {
-              chain.emplace_back(new Slice);
-              auto& xv=arg->hypercube().xvectors;
-              auto axisIt=find_if(xv.begin(), xv.end(),
-                                  [&](const XVector& j){return j.name==i.description;});
-              if (axisIt==xv.end()) throw runtime_error("axis "+i.description+" not found");
-              auto sliceIt=find_if(axisIt->begin(), axisIt->end(),
-                                   [&](const boost::any& j){return str(j,axisIt->dimension.units)==i.sliceLabel;});
-              // determine slice index
-              size_t sliceIdx=0;
-              if (sliceIt!=axisIt->end())
-                sliceIdx=sliceIt-axisIt->begin();
-              chain.back()->setArgument(arg, i.description, sliceIdx);
+              auto j=find(perm.begin(), perm.end(), xv.offset(h.maxLabel));
+              if (j!=perm.end())
+                perm.erase(j+1, perm.end());
             }
         }
-      }
+      return perm;
+    }
+
+    /// a stage of a Ravel chain, applied to the output of the previous stage
+    struct RavelStage
+    {
+      std::string key; ///< describes the handle state the stage implements
+      function<TensorPtr(const TensorPtr&)> create;
+    };
+
+    string join(const vector<string>& x)
+    {
+      string r;
+      for (auto& i: x) r+=i+'\0';
+      return r;
+    }
     
-    if (chain.back()->rank()>1)
+    /// The stages implementing \a state: sorts and calipers, then
+    /// reductions, then slices, then the final pivot. Slices come
+    /// last so that dragging a slicer only rebuilds the slices and pivot.
+    vector<RavelStage> ravelStages(const ravel::RavelState& state)
+    {
+      set<string> outputHandles(state.outputHandles.begin(), state.outputHandles.end());
+      vector<RavelStage> stages;
+      for (auto& i: state.handleStates)
+        if (i.order!=ravel::HandleSort::none || i.displayFilterCaliper)
+          stages.push_back
+            ({string("permute")+'\0'+i.description+'\0'+to_string(i.order)+'\0'+join(i.customOrder)+
+                (i.displayFilterCaliper? string("caliper")+'\0'+i.minLabel+'\0'+i.maxLabel: string()),
+                [&i](const TensorPtr& arg) {
+                  auto permuteAxis=make_shared<PermuteAxis>();
+                  permuteAxis->setArgument(arg, i.description);
+                  permuteAxis->setPermutation
+                    (handlePermutation(i, arg->hypercube().xvectors[permuteAxis->axis()]));
+                  return permuteAxis;
+                }});
+      for (auto& i: state.handleStates)
+        if (!outputHandles.count(i.description) && i.collapsed)
+          stages.push_back
+            ({string("reduce")+'\0'+i.description+'\0'+to_string(i.reductionOp),
+                [&i](const TensorPtr& arg) {
+                  auto r=createReductionOp(i.reductionOp);
+                  r->setArgument(arg, i.description);
+                  return r;
+                }});
+      for (auto& i: state.handleStates)
+        if (!outputHandles.count(i.description) && !i.collapsed)
+          stages.push_back
+            ({string("slice")+'\0'+i.description+'\0'+i.sliceLabel,
+                [&i](const TensorPtr& arg) {
+                  auto& xv=arg->hypercube().xvectors;
+                  auto axisIt=find_if(xv.begin(), xv.end(),
+                                      [&](const XVector& j){return j.name==i.description;});
+                  if (axisIt==xv.end()) throw runtime_error("axis "+i.description+" not found");
+                  // determine slice index
+                  size_t sliceIdx=axisIt->offset(i.sliceLabel);
+                  if (sliceIdx==axisIt->size())
+                    sliceIdx=0;
+                  auto slice=make_shared<Slice>();
+                  slice->setArgument(arg, i.description, sliceIdx);
+                  return slice;
+                }});
+      stages.push_back
+        ({string("pivot")+'\0'+join(state.outputHandles),
+            [&state](const TensorPtr& arg) -> TensorPtr {
+              if (arg->rank()<=1) return nullptr;
+              auto pivot=make_shared<Pivot>();
+              pivot->setArgument(arg);
+              pivot->setOrientation(state.outputHandles);
+              return pivot;
+            }});
+      return stages;
+    }
+  }
+  
+  vector<TensorPtr> createRavelChain(const ravel::RavelState& state, const TensorPtr& arg)
+  {
+    vector<TensorPtr> chain{arg};
+    for (auto& i: ravelStages(state))
+      if (auto t=i.create(chain.back()))
+        chain.push_back(t);
+    return chain;
+  }
+
+  const vector<TensorPtr>& RavelChain::update(const ravel::RavelState& state, const TensorPtr& arg)
+  {
+    // the chain's operations can be reused if the argument has the same shape
+    if (m_chain.empty() || arg->hypercube()!=argHypercube || arg->index().size()!=argIndex.size() ||
+        !equal(argIndex.begin(), argIndex.end(), arg->index().begin()))
       {
-        auto finalPivot=make_shared<Pivot>();
-        finalPivot->setArgument(chain.back());
-        finalPivot->setOrientation(state.outputHandles);
-        chain.push_back(finalPivot);
+        clear();
+        argHypercube=arg->hypercube();
+        argIndex=arg->index();
+        m_chain.push_back(proxy);
       }
-    return chain;
+    proxy->setArgument(arg);
+
+    auto stages=ravelStages(state);
+    // length of unchanged prefix of keys, which must all have generated operations
+    size_t prefix=0;
+    while (prefix<stages.size() && prefix<keys.size() && prefix+1<m_chain.size() &&
+           stages[prefix].key==keys[prefix])
+      ++prefix;
+    m_reused=prefix;
+    m_chain.resize(prefix+1);
+    keys.resize(prefix);
+    for (size_t i=prefix; i<stages.size(); ++i)
+      if (auto t=stages[i].create(m_chain.back()))
+        {
+          m_chain.push_back(t);
+          keys.push_back(stages[i].key);
+        }
+    return m_chain;
   }
-  
+
 }
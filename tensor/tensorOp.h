@@ -40,6 +40,11 @@ namespace civita
     const Hypercube& hypercube() const override {return arg? arg->hypercube(): m_hypercube;}
     const Index& index() const override {return arg? arg->index(): m_index;}
     double operator[](std::size_t i) const override {return arg? f((*arg)[i]): 0;}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      if (!arg) {std::fill(r, r+(end-begin), 0); return;}
+      arg->evaluate(r, begin, end);
+      for (auto i=r; i<r+(end-begin); ++i) *i=f(*i);
+    }
     std::size_t size() const override {return arg? arg->size(): 1;}
     Timestamp timestamp() const override {return arg? arg->timestamp(): Timestamp();}
   };
@@ -51,6 +56,8 @@ namespace civita
   protected:
     std::function<double(double,double)> f;
     TensorPtr arg1, arg2;
+    mutable std::vector<double> scratch; ///< arg2 values in evaluate
+    friend class FusedElementWiseOp;
   public:
     template <class F>
     BinOp(F f, const TensorPtr& arg1={},const TensorPtr& arg2={}):
@@ -74,8 +81,48 @@ namespace civita
       return f(arg1->rank()? arg1->atHCIndex(hcIndex): (*arg1)[0],
                arg2->rank()? arg2->atHCIndex(hcIndex): (*arg2)[0]);
     }
+    /// evaluate elements [\a begin, \a end) into \a r in a single
+    /// pass, merging the sparse argument indices rather than
+    /// searching them for each element
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
     Timestamp timestamp() const override
-    {return max(arg1->timestamp(), arg2->timestamp());}
+    {return std::max(arg1->timestamp(), arg2->timestamp());}
+  };
+
+  /// evaluates a tree of ElementWiseOps and dense BinOps as a single
+  /// postfix program, run over blocks of elements. Avoids recursing
+  /// through the tree per element, and the full sized temporaries of
+  /// each op's evaluate. The original tree is retained for
+  /// operator[] and structural queries.
+  class FusedElementWiseOp: public ITensor
+  {
+    struct Instruction
+    {
+      const ITensor* leaf=nullptr; ///< if set, push the leaf's values
+      std::function<double(double)> unary;
+      std::function<double(double,double)> binary;
+    };
+    TensorPtr m_root;
+    std::vector<Instruction> program;
+    std::size_t stackDepth=0;
+    mutable std::vector<std::vector<double>> stack;
+    void compile(const ITensor&, std::size_t depth);
+  public:
+    static const std::size_t blockSize=512;
+    explicit FusedElementWiseOp(const TensorPtr& root);
+    /// number of operations in the fusable tree rooted at \a t, 0 if
+    /// \a t is not an elementwise operation
+    static std::size_t fusableOps(const ITensor& t);
+    const TensorPtr& root() const {return m_root;}
+    /// number of instructions in the compiled program
+    std::size_t programSize() const {return program.size();}
+
+    const Hypercube& hypercube() const override {return m_root->hypercube();}
+    const Index& index() const override {return m_root->index();}
+    std::size_t size() const override {return m_root->size();}
+    Timestamp timestamp() const override {return m_root->timestamp();}
+    double operator[](std::size_t i) const override {return (*m_root)[i];}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
   };
 
   /// elementwise reduction over a vector of arguments
@@ -106,15 +153,39 @@ namespace civita
 
     double operator[](std::size_t) const override;
     Timestamp timestamp() const override {return arg->timestamp();}
+  protected:
+    mutable std::vector<double> argValues; ///< argument values, bulk evaluated
   };
 
   /// compute the reduction along the indicated dimension, ignoring
   /// any missing entry (NaNs)
   class ReductionOp: public ReduceAllOp
   {
+  protected:
+    using Reduce=std::function<void(double&,double,std::size_t)>;
+    /// all dimensions are reduced if >= arg's rank
     std::size_t dimension;
+    /// dense plan: the argument is laid out as [outer][dimSize][stride],
+    /// and the middle dimension is reduced
+    std::size_t stride=1, dimSize=1;
+    /// sparse plan, in compressed sparse row form: the argument
+    /// elements reduced into element i are entries[offsets[i]..offsets[i+1])
     struct SOI {std::size_t index, dimIndex;};
-    std::map<std::size_t, std::vector<SOI>> sumOverIndices;
+    std::vector<std::size_t> offsets;
+    std::vector<SOI> entries;
+    /// set if f carries state from one call to the next, so elements
+    /// must be reduced one at a time
+    bool sequential=false;
+    mutable std::vector<std::size_t> counts;
+    
+    /// all argument values if evaluating [\a begin,\a end) warrants
+    /// evaluating the argument in bulk, otherwise nullptr
+    const double* argumentValues(std::size_t begin, std::size_t end) const;
+    /// reduce elements [\a begin,\a end) into \a r using \a g, reading
+    /// \a values if not null, otherwise arg. If \a counts is not null,
+    /// it receives the number of non-NaN values reduced into each element.
+    void reduce(double* r, std::size_t begin, std::size_t end, const Reduce& g, double init,
+                const double* values, std::size_t* counts=nullptr) const;
   public:
    
     template <class F>
@@ -122,7 +193,14 @@ namespace civita
       ReduceAllOp(f,init) {ReduceAllOp::setArgument(arg,dimName,0);}
 
     void setArgument(const TensorPtr& a, const std::string&,double) override;
-    double operator[](std::size_t i) const override;
+    double operator[](std::size_t i) const override {
+      assert(i<size());
+      double r;
+      evaluate(&r,i,i+1);
+      return r;
+    }
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override
+    {reduce(r,begin,end,f,init,argumentValues(begin,end));}
   };
 
   // general tensor expression - all elements calculated and cached
@@ -130,14 +208,31 @@ namespace civita
   {
   protected:
     mutable TensorVal cachedResult;
-    mutable Timestamp m_timestamp;
-    /// computeTensor updates the above two mutable fields, but is
-    /// logically const
+    /// timestamp of the arguments when cachedResult was computed
+    mutable Timestamp m_timestamp=invalidTimestamp;
+    static constexpr Timestamp invalidTimestamp=~Timestamp(0);
+    /// computeTensor updates cachedResult, but is logically const
     virtual void computeTensor() const=0;
+    /// recompute cachedResult if the arguments have changed since it
+    /// was last computed
+    void updateCache() const {
+      auto t=timestamp();
+      if (t!=m_timestamp)
+        {
+          computeTensor();
+          m_timestamp=t;
+        }
+    }
+    /// force recomputation on next access, eg after arguments are reassigned
+    void invalidateCache() {m_timestamp=invalidTimestamp;}
   public:
     const Index& index() const override {return cachedResult.index();}
     std::size_t size() const override {return cachedResult.size();}
     double operator[](std::size_t i) const override;
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      updateCache();
+      cachedResult.evaluate(r, begin, end);
+    }
     const Hypercube& hypercube() const override {return cachedResult.hypercube();}
     const Hypercube& hypercube(const Hypercube& hc) override {return cachedResult.hypercube(hc);}
     const Hypercube& hypercube(Hypercube&& hc) override {return cachedResult.hypercube(std::move(hc));}
@@ -173,24 +268,32 @@ namespace civita
   /// calculates the average along an axis or whole tensor
   struct Average: public ReductionOp
   {
-    mutable std::size_t count;
   public:
-    Average(): ReductionOp([this](double& x, double y,std::size_t){x+=y; ++count;},0) {}
-    double operator[](std::size_t i) const override
-    {count=0; return ReductionOp::operator[](i)/count;}
+    Average(): ReductionOp([](double& x, double y,std::size_t){x+=y;},0) {}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      counts.resize(end-begin);
+      reduce(r,begin,end,f,init,argumentValues(begin,end),counts.data());
+      for (std::size_t i=0; i<counts.size(); ++i) r[i]/=counts[i];
+    }
   };
 
   /// calculates the standard deviation along an axis or whole tensor
   struct StdDeviation: public ReductionOp
   {
-    mutable std::size_t count;
-    mutable double sqr;
+    mutable std::vector<double> sqr;
   public:
-    StdDeviation(): ReductionOp([this](double& x, double y,std::size_t){x+=y; sqr+=y*y; ++count;},0) {}
-    double operator[](std::size_t i) const override {
-      count=0; sqr=0;
-      double av=ReductionOp::operator[](i)/count;
-      return sqrt(std::max(0.0, sqr/count-av*av));
+    StdDeviation(): ReductionOp([](double& x, double y,std::size_t){x+=y;},0) {}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      auto values=argumentValues(begin,end);
+      counts.resize(end-begin);
+      sqr.resize(end-begin);
+      reduce(r,begin,end,f,init,values,counts.data());
+      reduce(sqr.data(),begin,end,[](double& x, double y,std::size_t){x+=y*y;},0,values);
+      for (std::size_t i=0; i<sqr.size(); ++i)
+        {
+          double av=r[i]/counts[i];
+          r[i]=sqrt(std::max(0.0, sqr[i]/counts[i]-av*av));
+        }
     }
   };
   
@@ -203,14 +306,38 @@ namespace civita
     TensorPtr arg;
     void setArgument(const TensorPtr& a, const std::string&,double) override;
     Timestamp timestamp() const override {return arg? arg->timestamp(): Timestamp();}
+  protected:
+    mutable std::vector<double> argValues;
+    /// @return argument's values at each hypercube index, NaN where
+    /// absent from a sparse argument
+    const std::vector<double>& denseArgument() const;
   };
+
+  /// elements above which a scan's lanes are shared between threads
+  constexpr std::size_t parallelScanThreshold=1<<20;
   
   class Scan: public DimensionedArgCachedOp
   {
   public:
+    /// scans \a width adjacent lanes of \a n elements separated by \a
+    /// stride of \a v into \a r, accumulating over a \a window of
+    /// elements. \a k0 is the hypercube index of v[0]
+    using Kernel=std::function<void(double* r, const double* v, std::size_t n, std::size_t stride,
+                                     std::size_t width, std::size_t window, std::size_t k0)>;
     std::function<void(double&,double,std::size_t)> f;
     template <class F>
-    Scan(F f, const TensorPtr& arg={}, const std::string& dimName="", double av=0): f(f) 
+    Scan(F f, const TensorPtr& arg={}, const std::string& dimName="", double av=0):
+      Scan(f, [](double&,double,double&){return false;}, arg, dimName, av) {}
+    /// \a inverse(x,y,err) removes y from x accumulated by \a f,
+    /// allowing windowed scans in O(n). err is a running rounding
+    /// error estimate for x, zeroed whenever the window is recomputed,
+    /// that inverse may update. It returns false if the removal is not
+    /// possible or not accurate enough, and the window is recomputed.
+    template <class F, class I>
+    Scan(F f, I inverse, const TensorPtr& arg={}, const std::string& dimName="", double av=0):
+      f(f), kernel([=](double* r, const double* v, std::size_t n, std::size_t stride,
+                       std::size_t width, std::size_t window, std::size_t k0)
+                   {scanLanes(f,inverse,r,v,n,stride,width,window,k0);})
     {Scan::setArgument(arg,dimName,av);}
     void setArgument(const TensorPtr& arg, const std::string& dimName,double argVal) override {
       DimensionedArgCachedOp::setArgument(arg,dimName,argVal);
@@ -219,6 +346,41 @@ namespace civita
       // TODO - can we handle sparse data?
     }      
     void computeTensor() const override;
+  private:
+    Kernel kernel;
+    /// lanes are interleaved, so the inner loop is over adjacent lanes
+    template <class F, class I>
+    static void scanLanes(F f, I inverse, double* r, const double* v, std::size_t n,
+                          std::size_t stride, std::size_t width, std::size_t window,
+                          std::size_t k0)
+    {
+      for (std::size_t i=0; i<width; ++i) r[i]=v[i];
+      std::vector<double> err(window<n? width: 0);
+      for (std::size_t j=1; j<n; ++j)
+        {
+          auto prev=r+(j-1)*stride, cur=r+j*stride;
+          auto vj=v+j*stride;
+          auto k=k0+j*stride;
+          for (std::size_t i=0; i<width; ++i)
+            {
+              cur[i]=prev[i];
+              f(cur[i], vj[i], k+i);
+            }
+          if (j<window) continue;
+          // drop the element leaving the window, recomputing from
+          // scratch once per window to bound rounding drift
+          auto leaving=vj-window*stride;
+          bool refresh=j%window==0;
+          for (std::size_t i=0; i<width; ++i)
+            if (refresh || !inverse(cur[i], leaving[i], err[i]))
+              {
+                cur[i]=vj[i];
+                err[i]=0;
+                for (auto l=j+1-window; l<j; ++l)
+                  f(cur[i], v[l*stride+i], k0+l*stride+i);
+              }
+        }
+    }
   };
 
   /// corresponds to OLAP slice operation
@@ -227,26 +389,50 @@ namespace civita
     std::size_t stride=1, split=1, sliceIndex=0;
     TensorPtr arg;
     std::vector<std::size_t> arg_index;
+    mutable std::vector<double> argValues;
   public:
     void setArgument(const TensorPtr& a,const std::string&,double) override;
     double operator[](std::size_t i) const override;
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
     Timestamp timestamp() const override {return arg->timestamp();}
   };
 
+  /// The whole output of an op that rearranges its argument's
+  /// elements, kept until the argument's timestamp changes
+  struct MaterialisedOutput
+  {
+    std::vector<double> values;
+    ITensor::Timestamp timestamp=~ITensor::Timestamp(0);
+    bool current(ITensor::Timestamp t, std::size_t size) const
+    {return t==timestamp && values.size()==size;}
+    void invalidate() {timestamp=~ITensor::Timestamp(0); values.clear();}
+  };
+  
   /// corresponds to the OLAP pivot operation
   class Pivot: public ITensor
   {
     std::vector<std::size_t> permutation;   /// permutation of axes
+    std::vector<std::size_t> strides;       /// argument strides of each axis of this
     std::vector<std::size_t> permutedIndex; /// argument indices corresponding to this indices, when sparse
     TensorPtr arg;
+    mutable std::vector<double> argValues;
+    mutable MaterialisedOutput materialised;
     // returns hypercube index of arg given hypercube index of this
     std::size_t pivotIndex(std::size_t i) const;
+    /// evaluate elements [begin,end) directly from the argument
+    void permute(double* r, std::size_t begin, std::size_t end) const;
+    /// cache blocked transpose of the dense argument \a values into \a r
+    void transpose(const double* values, double* r) const;
   public:
     void setArgument(const TensorPtr& a,const std::string& axis="",double arg=0) override;
     /// set's the pivots orientation
     /// @param axes - list of axes that are the output
     void setOrientation(const std::vector<std::string>& axes);
     double operator[](std::size_t i) const override;
+    /// walks the argument with strides, rather than splitting each
+    /// index. If most of the output is requested, the whole output
+    /// is materialised and reused until the argument changes.
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
     Timestamp timestamp() const override {return arg->timestamp();}
   };
 
@@ -256,6 +442,9 @@ namespace civita
     std::size_t m_axis;
     std::vector<std::size_t> m_permutation;
     std::vector<std::size_t> permutedIndex; /// argument indices corresponding to this indices, when sparse
+    mutable std::vector<double> argValues;
+    mutable MaterialisedOutput materialised;
+    void permute(double* r, std::size_t begin, std::size_t end) const;
   public:
     void setArgument(const TensorPtr& a,const std::string& axis="",double arg=0) override;
     void setPermutation(const std::vector<std::size_t>& p)
@@ -264,6 +453,10 @@ namespace civita
     std::size_t axis() const {return m_axis;}
     const std::vector<std::size_t>& permutation() const {return m_permutation;}
     double operator[](std::size_t i) const override;
+    /// copies runs of elements below the permuted axis in bulk. If
+    /// most of the output is requested, the whole output is
+    /// materialised and reused until the argument changes.
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override;
     Timestamp timestamp() const override {return arg->timestamp();}
   };
 
@@ -280,15 +473,16 @@ namespace civita
       else
         arg=a;
       cachedResult.hypercube(a->hypercube()); // no data, unsorted
+      invalidateCache();
     }
     void computeTensor() const override;
     Timestamp timestamp() const override {return arg->timestamp();}
     const Hypercube& hypercube() const override {
-      if (timestamp()>m_timestamp) computeTensor();
+      updateCache();
       return cachedResult.hypercube();
     }
     std::size_t size() const override {
-      if (timestamp()>m_timestamp) computeTensor();
+      updateCache();
       return cachedResult.size();
     }
   };
@@ -318,11 +512,13 @@ namespace civita
       m_hypercube=hc;
       m_hypercube.xvectors.insert(m_hypercube.xvectors.end(), arg->hypercube().xvectors.begin(),
                                   arg->hypercube().xvectors.end());
-      std::set<std::size_t> idx;
-      for (auto& i: arg->index())
+      // generated in sorted order, as j<numSpreadElements
+      std::vector<std::size_t> idx;
+      idx.reserve(arg->index().size()*numSpreadElements);
+      for (auto i: arg->index())
         for (std::size_t j=0; j<numSpreadElements; ++j)
-          idx.insert(j+i*numSpreadElements);
-      m_index=idx;
+          idx.push_back(j+i*numSpreadElements);
+      m_index=std::move(idx);
     }
     
     double operator[](std::size_t i) const override {
@@ -339,11 +535,14 @@ namespace civita
       numSpreadElements=hc.numElements();
       m_hypercube=arg->hypercube();
       m_hypercube.xvectors.insert(m_hypercube.xvectors.end(), hc.xvectors.begin(), hc.xvectors.end());
-      std::set<std::size_t> idx;
-      for (auto& i: arg->index())
-        for (std::size_t j=0; j<numSpreadElements; ++j)
-          idx.insert(i+j*arg->size());
-      m_index=idx;
+      // generated in sorted order, as arg's hypercube indices are less than stride
+      auto stride=arg->hypercube().numElements();
+      std::vector<std::size_t> idx;
+      idx.reserve(arg->index().size()*numSpreadElements);
+      for (std::size_t j=0; j<numSpreadElements; ++j)
+        for (auto i: arg->index())
+          idx.push_back(i+j*stride);
+      m_index=std::move(idx);
     }
     
     double operator[](std::size_t i) const override {
@@ -357,6 +556,52 @@ namespace civita
   /// state \a state, operating on \a arg
   std::vector<TensorPtr> createRavelChain(const ravel::RavelState&, const TensorPtr& arg);
 
+  /// Forwards to an argument that can be replaced by another of the
+  /// same shape, without reconstructing the operations built on it
+  class ArgumentProxy: public ITensor
+  {
+    TensorPtr arg;
+    /// timestamp of the last replacement
+    Timestamp replaced=0;
+  public:
+    void setArgument(const TensorPtr& a,const std::string& d={},double x=0) override {
+      arg=a;
+      replaced=newTimestamp();
+    }
+    double operator[](std::size_t i) const override {return (*arg)[i];}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override
+    {arg->evaluate(r,begin,end);}
+    std::size_t size() const override {return arg->size();}
+    const Index& index() const override {return arg->index();}
+    const Hypercube& hypercube() const override {return arg->hypercube();}
+    /// caches built on the previous argument are stale
+    Timestamp timestamp() const override {return std::max(arg->timestamp(), replaced);}
+  };
+
+  /// Chain of tensor operations representing a Ravel, maintained
+  /// incrementally as the Ravel's state changes. The chain's
+  /// operations are keyed by the handle state they implement, and
+  /// the longest unchanged prefix is reused, along with its indices.
+  class RavelChain
+  {
+    std::shared_ptr<ArgumentProxy> proxy=std::make_shared<ArgumentProxy>();
+    /// shape of the argument the chain was built for
+    Hypercube argHypercube;
+    Index argIndex;
+    /// m_chain[0] is proxy, and keys[i] describes m_chain[i+1]
+    std::vector<TensorPtr> m_chain;
+    std::vector<std::string> keys;
+    std::size_t m_reused=0;
+  public:
+    /// update the chain to represent a Ravel in state \a state,
+    /// operating on \a arg
+    const std::vector<TensorPtr>& update(const ravel::RavelState& state, const TensorPtr& arg);
+    const std::vector<TensorPtr>& chain() const {return m_chain;}
+    /// number of operations reused from the previous chain by the last update
+    std::size_t reused() const {return m_reused;}
+    void clear() {m_chain.clear(); keys.clear(); m_reused=0;}
+  };
+
 }
 
 #endif
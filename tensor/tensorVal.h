@@ -21,6 +21,7 @@
 #define CIVITA_TENSORVAL_H
 
 #include "tensorInterface.h"
+#include <algorithm>
 #include <vector>
 #include <chrono>
 
@@ -48,7 +49,7 @@ namespace civita
     template <class T>
     double& operator()(const std::initializer_list<T>& indices)
     {
-      auto idx=index();
+      auto& idx=index();
       auto hcIdx=hcIndex(indices);
       if (idx.empty())
         return operator[](hcIdx);
@@ -82,7 +83,7 @@ namespace civita
   class TensorVal: public ITensorVal
   {
     std::vector<double> data;
-    Timestamp m_timestamp;
+    Timestamp m_timestamp=0;
     CLASSDESC_ACCESS(TensorVal);
   public:
     TensorVal(): data(1) {}
@@ -116,11 +117,17 @@ namespace civita
     
     double operator[](std::size_t i) const override {return data.empty()? 0: data[i];}
     double& operator[](std::size_t i) override {return data[i];}
+    void evaluate(double* r, std::size_t begin, std::size_t end) const override {
+      if (data.empty())
+        std::fill(r, r+(end-begin), 0);
+      else
+        std::copy(data.begin()+begin, data.begin()+end, r);
+    }
     const TensorVal& operator=(const ITensor& x) override {
       index(x.index());
       hypercube(x.hypercube());
       assert(data.size()==x.size());
-      for (std::size_t i=0; i<x.size(); ++i) data[i]=x[i];
+      x.evaluate(data.data(), 0, data.size());
       updateTimestamp();
       return *this;
     }
@@ -128,7 +135,7 @@ namespace civita
     Timestamp timestamp() const override {return m_timestamp;}
     // timestamp should be updated every time the data r index vectors
     // is updated, if using the CachedTensorOp functionality
-    void updateTimestamp() {m_timestamp=std::chrono::high_resolution_clock::now();}
+    void updateTimestamp() {m_timestamp=newTimestamp();}
   };
 
   /// for use in Minsky init expressions
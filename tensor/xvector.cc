@@ -18,6 +18,7 @@
 */
 
 #include "xvector.h"
+#include <algorithm>
 #include <error.h>
 #include <regex>
 #include "minsky_epilogue.h"
@@ -75,9 +76,17 @@ namespace civita
         switch (dimension.type)
           {
           case Dimension::string:
-            if (anyStringCast(*i)!=anyStringCast(*j))
-              return false;
-            break;
+            {
+              // compare in place if possible, rather than copying
+              auto si=any_cast<string>(&*i), sj=any_cast<string>(&*j);
+              if (si && sj)
+                {
+                  if (*si!=*sj) return false;
+                }
+              else if (anyStringCast(*i)!=anyStringCast(*j))
+                return false;
+              break;
+            }
           case Dimension::value:
             if (any_cast<double>(*i)!=any_cast<double>(*j))
               return false;
@@ -96,6 +105,40 @@ namespace civita
     V::push_back(anyVal(dimension, s));
   }
 
+  void XVector::buildIndex() const
+  {
+    auto offsets=std::make_shared<LabelIndex::Offsets>();
+    offsets->reserve(size());
+    for (size_t i=0; i<size(); ++i)
+      offsets->emplace(str((*this)[i], dimension.units), i);
+    labelIndex.offsets=offsets;
+    labelIndex.size=size();
+    labelIndex.format=dimension.units;
+  }
+  
+  size_t XVector::offset(const string& label) const
+  {
+    boost::lock_guard<boost::mutex> lock(labelIndex.mutex);
+    if (!labelIndex.offsets || labelIndex.size!=size() || labelIndex.format!=dimension.units)
+      buildIndex();
+    auto i=labelIndex.offsets->find(label);
+    if (i==labelIndex.offsets->end()) return size();
+    // labels may have been modified in place since the index was built
+    if (str((*this)[i->second], dimension.units)!=label)
+      {
+        buildIndex();
+        i=labelIndex.offsets->find(label);
+        if (i==labelIndex.offsets->end()) return size();
+      }
+    return i->second;
+  }
+
+  void XVector::invalidateIndex() const
+  {
+    boost::lock_guard<boost::mutex> lock(labelIndex.mutex);
+    labelIndex.offsets.reset();
+  }
+
   boost::any anyVal(const Dimension& dim, const std::string& s)
   {
     switch (dim.type)
@@ -306,6 +349,119 @@ namespace civita
     return "%s";
   }
   
+  LabelColumn::LabelColumn(const XVector& x): m_type(x.dimension.type), m_size(x.size())
+  {
+    switch (m_type)
+      {
+      case Dimension::string:
+        {
+          vector<string> labels;
+          labels.reserve(x.size());
+          for (auto& i: x)
+            if (auto s=any_cast<string>(&i))
+              labels.push_back(*s);
+            else
+              labels.push_back(civita::str(i));
+          // intern by sorting positions rather than strings, assigning ids to runs of equal labels
+          vector<uint32_t> order(labels.size());
+          for (size_t i=0; i<order.size(); ++i) order[i]=i;
+          sort(order.begin(), order.end(), [&](uint32_t i, uint32_t j){return labels[i]<labels[j];});
+          stringIds.resize(labels.size());
+          for (size_t i=0; i<order.size(); ++i)
+            {
+              if (i==0 || labels[order[i]]!=strings.back())
+                strings.push_back(labels[order[i]]);
+              stringIds[order[i]]=strings.size()-1;
+            }
+          break;
+        }
+      case Dimension::value:
+        values.reserve(x.size());
+        for (auto& i: x)
+          if (auto v=any_cast<double>(&i))
+            values.push_back(*v);
+          else
+            values.push_back(any_cast<double>(anyVal(x.dimension, civita::str(i))));
+        break;
+      case Dimension::time:
+        times.reserve(x.size());
+        for (auto& i: x)
+          if (auto v=any_cast<ptime>(&i))
+            times.push_back(*v);
+          else
+            times.push_back(any_cast<ptime>(anyVal(x.dimension, civita::str(i))));
+        break;
+      }
+  }
+
+  int LabelColumn::compare(size_t i, size_t j) const
+  {
+    switch (m_type)
+      {
+      case Dimension::string:
+        return int(stringIds[i])-int(stringIds[j]);
+      case Dimension::value:
+        return values[i]<values[j]? -1: values[j]<values[i];
+      case Dimension::time:
+        return times[i]<times[j]? -1: times[j]<times[i];
+      }
+    return 0;
+  }
+
+  size_t LabelColumn::hash(size_t i) const
+  {
+    switch (m_type)
+      {
+      case Dimension::string:
+        return std::hash<string>()(strings[stringIds[i]]);
+      case Dimension::value:
+        return std::hash<double>()(values[i]);
+      case Dimension::time:
+        return std::hash<int64_t>()((times[i]-ptime(date(1970,1,1))).ticks());
+      }
+    return 0;
+  }
+
+  boost::any LabelColumn::operator[](size_t i) const
+  {
+    switch (m_type)
+      {
+      case Dimension::string: return strings[stringIds[i]];
+      case Dimension::value: return values[i];
+      case Dimension::time: return times[i];
+      }
+    return {};
+  }
+
+  string LabelColumn::str(size_t i, const string& format) const
+  {
+    switch (m_type)
+      {
+      case Dimension::string: return strings[stringIds[i]];
+      case Dimension::value: return to_string(values[i]);
+      default: return civita::str((*this)[i], format);
+      }
+  }
+
+  vector<size_t> LabelColumn::sortPermutation(bool reverse) const
+  {
+    vector<size_t> r(m_size);
+    for (size_t i=0; i<m_size; ++i) r[i]=i;
+    auto sortBy=[&](const auto& keys) {
+      if (reverse)
+        stable_sort(r.begin(), r.end(), [&](size_t i, size_t j){return keys[j]<keys[i];});
+      else
+        stable_sort(r.begin(), r.end(), [&](size_t i, size_t j){return keys[i]<keys[j];});
+    };
+    switch (m_type)
+      {
+      case Dimension::string: sortBy(stringIds); break;
+      case Dimension::value: sortBy(values); break;
+      case Dimension::time: sortBy(times); break;
+      }
+    return r;
+  }
+  
   void XVector::imposeDimension()
   {
     // check if anything to be done
@@ -324,6 +480,7 @@ namespace civita
 
     for (auto& i: *this)
       i=anyVal(dimension, str(i));
+    invalidateIndex();
     assert(checkThisType());
   }
 
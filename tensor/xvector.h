@@ -22,8 +22,14 @@
 #include "dimension.h"
 #include <boost/any.hpp>
 #include <boost/date_time.hpp>
-#include <vector>
+#include <cstdint>
+// std::mutex not supported on MXE
+#include <boost/thread/lock_guard.hpp>
+#include <boost/thread/mutex.hpp>
 #include <initializer_list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 namespace civita
 {
@@ -71,6 +77,17 @@ namespace civita
     std::string timeFormat() const;
     /// rewrites the labels according to dimension
     void imposeDimension();
+    /// @return position of the first label whose string
+    /// representation, as formatted by dimension.units, is \a label,
+    /// or size() if there is none. Uses a hash index built on first
+    /// use, and rebuilt when the number of labels or the format
+    /// changes, or when a label found no longer matches. A label
+    /// changed in place to a new value is not found until
+    /// invalidateIndex() is called.
+    std::size_t offset(const std::string& label) const;
+    /// discard the label index. Call after modifying labels in place
+    /// through the std::vector interface.
+    void invalidateIndex() const;
     /// @return true if all elements of this are of type T
     template <class T>
     bool checkType() const {
@@ -93,6 +110,60 @@ namespace civita
       return false;
     }
 
+  private:
+    /// cache of label→offset. Copies of the labels share the built
+    /// index, which is replaced rather than modified when rebuilt.
+    struct LabelIndex
+    {
+      using Offsets=std::unordered_map<std::string, std::size_t>;
+      LabelIndex() {}
+      LabelIndex(const LabelIndex& x) {*this=x;}
+      LabelIndex& operator=(const LabelIndex& x) {
+        if (this==&x) return *this;
+        boost::lock_guard<boost::mutex> lock(x.mutex);
+        offsets=x.offsets;
+        size=x.size;
+        format=x.format;
+        return *this;
+      }
+      mutable boost::mutex mutex;
+      std::shared_ptr<const Offsets> offsets; ///< null if not built
+      std::size_t size=0; ///< number of labels when built
+      std::string format; ///< format used to build offsets
+    };
+    mutable LabelIndex labelIndex;
+    void buildIndex() const;
+  };
+
+  /// The labels of an XVector held contiguously in their native type,
+  /// as selected by the dimension type, for comparing, sorting and
+  /// hashing large axes without boost::any dispatch per
+  /// element. Strings are interned, with ids in lexicographic order.
+  class LabelColumn
+  {
+  public:
+    explicit LabelColumn(const XVector&);
+    Dimension::Type type() const {return m_type;}
+    std::size_t size() const {return m_size;}
+    /// <0, 0 or >0 as label \a i is less than, equal to or greater
+    /// than label \a j, ordered as by diff()
+    int compare(std::size_t i, std::size_t j) const;
+    bool less(std::size_t i, std::size_t j) const {return compare(i,j)<0;}
+    /// hash of label \a i's value, equal for equal labels of different columns
+    std::size_t hash(std::size_t i) const;
+    /// label \a i as used by the boost::any based API
+    boost::any operator[](std::size_t i) const;
+    std::string str(std::size_t i, const std::string& format="") const;
+    /// permutation sorting the labels into ascending, or if \a
+    /// reverse, descending order. Equal labels retain their order.
+    std::vector<std::size_t> sortPermutation(bool reverse=false) const;
+  private:
+    Dimension::Type m_type;
+    std::size_t m_size=0;
+    std::vector<double> values;
+    std::vector<boost::posix_time::ptime> times;
+    std::vector<std::uint32_t> stringIds; ///< indices into strings
+    std::vector<std::string> strings; ///< sorted and unique
   };
 
 }
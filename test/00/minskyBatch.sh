@@ -0,0 +1,67 @@
+#! /bin/sh
+
+# check minsky-batch runs each variant of a model, and that parallel
+# runs give the same results as sequential ones. minsky-batch fails a
+# variant if its run reconstructed the equations compiled at load.
+
+here=`pwd`
+if test $? -ne 0; then exit 2; fi
+tmp=/tmp/$$
+mkdir $tmp
+if test $? -ne 0; then exit 2; fi
+cd $tmp
+if test $? -ne 0; then exit 2; fi
+
+fail()
+{
+    echo "FAILED" 1>&2
+    cd $here
+    chmod -R u+w $tmp
+    rm -rf $tmp
+    exit 1
+}
+
+pass()
+{
+    echo "PASSED" 1>&2
+    cd $here
+    chmod -R u+w $tmp
+    rm -rf $tmp
+    exit 0
+}
+
+trap "fail" 1 2 3 15
+
+cat >variants.txt <<EOF
+# initial value of the exponential
+y=1
+y=2
+EOF
+
+$here/batch/minsky-batch -j 1 -t 1 -o seq $here/examples/exponentialGrowth.mky variants.txt
+if test $? -ne 0; then fail; fi
+$here/batch/minsky-batch -j 2 -t 1 -o par $here/examples/exponentialGrowth.mky variants.txt
+if test $? -ne 0; then fail; fi
+
+for i in 0 1; do
+    if test ! -s seq/exponentialGrowth-$i.dat; then fail; fi
+    cmp seq/exponentialGrowth-$i.dat par/exponentialGrowth-$i.dat
+    if test $? -ne 0; then fail; fi
+done
+
+# the model is linear in y, so doubling its initial value doubles y at t=1
+cat >compare.awk <<'EOF'
+FNR==1 {for (i=2; i<=NF; ++i) if ($i=="y" || $i==":y") col=i; next}
+{y[FILENAME]=$col; t[FILENAME]=$1}
+END {
+  if (!col) exit 1
+  y0=y[ARGV[1]]; y1=y[ARGV[2]]
+  if (t[ARGV[1]]<1 || t[ARGV[2]]<1 || y0==0) exit 1
+  r=y1/y0-2
+  exit (r<-1e-4 || r>1e-4)
+}
+EOF
+awk -f compare.awk seq/exponentialGrowth-0.dat seq/exponentialGrowth-1.dat
+if test $? -ne 0; then fail; fi
+
+pass
@@ -0,0 +1,27 @@
+#!../gui-tk/minsky
+# compares per step times of the EvalOpVector and compiled tape
+# equation evaluators on the models passed on the command line, eg
+#   gui-tk/minsky test/evalTapeBenchmark.tcl examples/*.mky
+
+use_namespace minsky
+puts [format "%-50s %12s %12s" model "ops(ms)" "tape(ms)"]
+for {set i 2} {$i<$argc} {incr i} {
+    minsky.load $argv($i)
+    minsky.implicit 0
+    minsky.order 4
+    minsky.nSteps 100
+    set result [format "%-50s" [file tail $argv($i)]]
+    foreach tape {0 1} {
+        minsky.evalTape $tape
+        if [catch {
+            minsky.reset
+            minsky.running 1
+            set usec [lindex [time {minsky.step} 10] 0]
+            append result [format " %12.3f" [expr $usec/1000.0]]
+        }] {
+            append result [format " %12s" "n/a"]
+        }
+    }
+    puts $result
+}
+tcl_exit
@@ -0,0 +1,27 @@
+#!../gui-tk/minsky
+# compares the dense and coloured (sparse) Jacobian computations on the
+# models passed on the command line, eg
+#   gui-tk/minsky test/jacobianBenchmark.tcl examples/*.mky
+
+use_namespace minsky
+puts [format "%-50s %12s %12s" model "dense(ms)" "sparse(ms)"]
+for {set i 2} {$i<$argc} {incr i} {
+    minsky.load $argv($i)
+    minsky.implicit 1
+    minsky.order 4
+    minsky.nSteps 10
+    set result [format "%-50s" [file tail $argv($i)]]
+    foreach sparse {0 1} {
+        minsky.sparseJacobian $sparse
+        if [catch {
+            minsky.reset
+            minsky.running 1
+            set usec [lindex [time {minsky.step} 10] 0]
+            append result [format " %12.3f" [expr $usec/1000.0]]
+        }] {
+            append result [format " %12s" "n/a"]
+        }
+    }
+    puts $result
+}
+tcl_exit
@@ -0,0 +1,84 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// compares serial and parallel evaluation of a synthetic model of
+// many independent equations dx_i/dt = c_i exp(sin(x_i))
+
+#include "minsky.h"
+#include "minsky_epilogue.h"
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <iostream>
+using namespace minsky;
+using namespace std;
+using namespace boost::posix_time;
+
+namespace minsky {void doOneEvent(bool) {}}
+namespace ecolab {Tk_Window mainWin=0;}
+
+namespace
+{
+  struct WideModel: public Minsky
+  {
+    LocalMinsky lm;
+    WideModel(unsigned width): lm(*this)
+    {
+      for (unsigned i=0; i<width; ++i)
+        {
+          auto intOp=new IntOp;
+          model->addItem(intOp);
+          auto sinOp=model->addItem(OperationPtr(OperationType::sin));
+          auto expOp=model->addItem(OperationPtr(OperationType::exp));
+          auto mul=model->addItem(OperationPtr(OperationType::multiply));
+          auto c=model->addItem(new VarConstant);
+          c->variableCast()->init("0.01");
+          model->addWire(*intOp->intVar, *sinOp, 1);
+          model->addWire(*sinOp, *expOp, 1);
+          model->addWire(*expOp, *mul, 1);
+          model->addWire(*c, *mul, 2);
+          model->addWire(*mul, *intOp, 1);
+        }
+      parallelEvalThreshold=1;
+    }
+
+    /// @return time in microseconds per right hand side evaluation
+    double time(bool parallel)
+    {
+      reset();
+      if (!parallel) schedule.clear();
+      vector<double> result(stockVars.size());
+      const int n=100;
+      auto start=microsec_clock::local_time();
+      for (int i=0; i<n; ++i)
+        evalEquations(&result[0],t,&stockVars[0]);
+      return (microsec_clock::local_time()-start).total_microseconds()/double(n);
+    }
+  };
+}
+
+int main()
+{
+  cout << "width\tserial(us)\tparallel(us)"<<endl;
+  for (unsigned width: {10, 100, 1000, 10000})
+    {
+      WideModel m(width);
+      auto serial=m.time(false);
+      auto parallel=m.time(true);
+      cout << width << "\t" << serial << "\t" << parallel << endl;
+    }
+}
@@ -0,0 +1,33 @@
+#!../gui-tk/minsky
+# tabulates steps, right hand side evaluations and wall time taken by
+# each ODE solver to simulate the models passed on the command line, eg
+#   gui-tk/minsky test/solverBenchmark.tcl examples/*.mky
+
+use_namespace minsky
+set solvers {standard rkck rk8pd bsimp msadams msbdf}
+puts [format "%-40s %-9s %10s %10s %10s" model solver steps "RHS calls" "time(ms)"]
+for {set i 2} {$i<$argc} {incr i} {
+    minsky.load $argv($i)
+    set tmax [expr [minsky.t0]+1]
+    foreach solver $solvers {
+        minsky.solver $solver
+        minsky.nSteps 100
+        set result [format "%-40s %-9s" [file tail $argv($i)] $solver]
+        if [catch {
+            minsky.reset
+            minsky.solverStats.enabled 1
+            minsky.solverStats.clear
+            minsky.running 1
+            set usec [lindex [time {
+                while {[minsky.t]<$tmax} minsky.step
+            }] 0]
+            append result [format " %10d %10d %10.1f" [minsky.solverStats.steps] \
+                               [minsky.solverStats.evalEquations.count] [expr $usec/1000.0]]
+        }] {
+            append result [format " %10s" "failed"]
+        }
+        minsky.solverStats.enabled 0
+        puts $result
+    }
+}
+tcl_exit
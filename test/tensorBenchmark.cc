@@ -0,0 +1,421 @@
+/*
+  @copyright Steve Keen 2021
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// benchmarks of civita tensor operations
+
+#include "contraction.h"
+#include "interpolateHypercube.h"
+#include "tensorOp.h"
+#include "xvector.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+using namespace civita;
+using namespace std;
+
+namespace
+{
+  /// @return time in microseconds taken by \a f, averaged over \a n calls
+  template <class F> double time(F f, int n=10)
+  {
+    auto start=chrono::steady_clock::now();
+    for (int i=0; i<n; ++i) f();
+    return chrono::duration<double,micro>(chrono::steady_clock::now()-start).count()/n;
+  }
+
+  /// a random tensor with \a fill fraction of a hypercube of \a dims nonzero
+  shared_ptr<TensorVal> sparseTensor(const vector<unsigned>& dims, double fill, unsigned seed)
+  {
+    auto r=make_shared<TensorVal>(dims);
+    if (fill<1)
+      {
+        mt19937 gen(seed);
+        uniform_real_distribution<> uniform;
+        map<size_t,double> data;
+        auto n=r->hypercube().numElements();
+        for (size_t i=0; i<n; ++i)
+          if (uniform(gen)<fill)
+            data[i]=uniform(gen);
+        *r=data;
+      }
+    else
+      for (auto& i: *r) i=1;
+    r->updateTimestamp();
+    return r;
+  }
+
+  void binOp()
+  {
+    cout << "BinOp: 1000x1000 hypercube"<<endl;
+    cout << "fill\tnonzeros\tsetArguments(us)\telementwise(us)\tevaluate(us)"<<endl;
+    for (double fill: {1e-4, 1e-3, 1e-2, 1e-1, 1.0})
+      {
+        auto a=sparseTensor({1000,1000}, fill, 1), b=sparseTensor({1000,1000}, fill, 2);
+        BinOp op([](double x,double y){return x+y;});
+        auto setup=time([&]{op.setArguments(a,b,{},0);});
+        vector<double> r(op.size());
+        auto elementwise=time([&]{for (size_t i=0; i<r.size(); ++i) r[i]=op[i];});
+        auto bulk=time([&]{op.evaluate(r.data(),0,r.size());});
+        cout << fill << "\t" << r.size() << "\t" << setup << "\t" << elementwise << "\t" << bulk << endl;
+      }
+  }
+
+  /// compares element by element evaluation of an expression chain with evaluate
+  void chain()
+  {
+    cout << "chain: 100x100x100 hypercube"<<endl;
+    cout << "expression\telementwise(us)\tevaluate(us)"<<endl;
+    auto a=sparseTensor({100,100,100}, 1, 1), b=sparseTensor({100,100,100}, 1, 2);
+    auto sum=make_shared<BinOp>([](double x,double y){return x+y;}, a, b);
+    auto exp=make_shared<ElementWiseOp>([](double x){return std::exp(x);}, sum);
+    auto pivot=make_shared<Pivot>();
+    pivot->setArgument(exp);
+    pivot->setOrientation({"2","0","1"});
+    auto permute=make_shared<PermuteAxis>();
+    permute->setArgument(exp,"1");
+    vector<size_t> reversed;
+    for (size_t i=100; i>0; --i) reversed.push_back(i-1);
+    permute->setPermutation(reversed);
+    auto slice=make_shared<Slice>();
+    slice->setArgument(permute,"1",50);
+    auto reduce=make_shared<Sum>();
+    reduce->setArgument(exp,"1",0);
+
+    for (auto& e: vector<pair<string,TensorPtr>>{
+        {"exp(a+b)",exp}, {"pivot",pivot}, {"permute",permute}, {"slice",slice}, {"sum",reduce}})
+      {
+        auto& op=*e.second;
+        vector<double> r(op.size());
+        auto elementwise=time([&]{for (size_t i=0; i<r.size(); ++i) r[i]=op[i];});
+        auto bulk=time([&]{op.evaluate(r.data(),0,r.size());});
+        cout << e.first << "\t" << elementwise << "\t" << bulk << endl;
+      }
+  }
+
+  void reduction()
+  {
+    cout << "Sum: 100x100x100 hypercube"<<endl;
+    cout << "fill\taxis\tsetArgument(us)\telementwise(us)\tevaluate(us)"<<endl;
+    for (double fill: {1e-2, 1.0})
+      {
+        auto a=sparseTensor({100,100,100}, fill, 1);
+        for (auto axis: {"0","1","2"})
+          {
+            Sum op;
+            auto setup=time([&]{op.setArgument(a,axis,0);});
+            vector<double> r(op.size());
+            auto elementwise=time([&]{for (size_t i=0; i<r.size(); ++i) r[i]=op[i];});
+            auto bulk=time([&]{op.evaluate(r.data(),0,r.size());});
+            cout << fill << "\t" << axis << "\t" << setup << "\t" << elementwise << "\t" << bulk << endl;
+          }
+      }
+  }
+
+  /// the contraction previously used by innerProduct, for comparison
+  void naiveContract(size_t m, size_t k, size_t n, const ITensor& a, const ITensor& b, double* c)
+  {
+    for (size_t i=0; i<m; ++i)
+      for (size_t j=0; j<n; ++j)
+        {
+          double sum=0;
+          for (size_t p=0; p<k; ++p)
+            {
+              auto x=a.atHCIndex(p*m+i), y=b.atHCIndex(j*k+p);
+              if (!isnan(x) && !isnan(y)) sum+=x*y;
+            }
+          c[i+m*j]=sum;
+        }
+  }
+  
+  void innerProduct()
+  {
+    cout << "innerProduct: nxn by nxn"<<endl;
+    cout << "n\tfill\tnaive(us)\t1 thread(us)\tthreaded(us)"<<endl;
+    for (unsigned n: {100, 300, 1000, 2000, 5000})
+      for (double fill: {0.01, 1.0})
+        {
+          auto a=sparseTensor({n,n}, fill, 1), b=sparseTensor({n,n}, 1, 2);
+          vector<double> c(size_t(n)*n);
+          int repeats=n<1000? 10: 1;
+          cout << n << "\t" << fill << "\t";
+          if (n<=300)
+            cout << time([&]{naiveContract(n,n,n,*a,*b,c.data());}, repeats);
+          cout << "\t";
+          if (n<=2000)
+            cout << time([&]{contract(n,n,n,*a,*b,c.data(),1);}, repeats);
+          cout << "\t" << time([&]{contract(n,n,n,*a,*b,c.data());}, repeats) << endl;
+        }
+  }
+
+  /// compares evaluation of exp(a*b+c)/d as a tree of ops, and fused into a single kernel
+  void fusion()
+  {
+    cout << "fusion: exp(a*b+c)/d over a 1000x1000 hypercube"<<endl;
+    cout << "elementwise(us)\tevaluate(us)\tfused(us)"<<endl;
+    auto a=sparseTensor({1000,1000}, 1, 1), b=sparseTensor({1000,1000}, 1, 2),
+      c=sparseTensor({1000,1000}, 1, 3), d=sparseTensor({1000,1000}, 1, 4);
+    auto ab=make_shared<BinOp>([](double x,double y){return x*y;}, a, b);
+    auto abc=make_shared<BinOp>([](double x,double y){return x+y;}, ab, c);
+    auto exp=make_shared<ElementWiseOp>([](double x){return std::exp(x);}, abc);
+    auto root=make_shared<BinOp>([](double x,double y){return x/y;}, exp, d);
+    FusedElementWiseOp fused(root);
+    vector<double> r(root->size());
+    auto elementwise=time([&]{for (size_t i=0; i<r.size(); ++i) r[i]=(*root)[i];});
+    auto bulk=time([&]{root->evaluate(r.data(),0,r.size());});
+    auto fusedTime=time([&]{fused.evaluate(r.data(),0,r.size());});
+    cout << elementwise << "\t" << bulk << "\t" << fusedTime << endl;
+  }
+
+  /// compares sorting, comparing and hashing labels through boost::any and LabelColumn
+  void labels()
+  {
+    cout << "labels: 100000 labels"<<endl;
+    cout << "type\tbuild column(us)\tsort any(us)\tsort column(us)\tXVector==(us)\thash any(us)\thash column(us)"<<endl;
+    mt19937 gen(1);
+    uniform_int_distribution<> uniform(0,1000000);
+    for (auto type: {Dimension::string, Dimension::value, Dimension::time})
+      {
+        XVector x("x",{type,""});
+        for (size_t i=0; i<100000; ++i)
+          switch (type)
+            {
+            case Dimension::string: x.push_back("label"+to_string(uniform(gen))); break;
+            case Dimension::value: x.push_back(to_string(uniform(gen))); break;
+            case Dimension::time: x.push_back(to_string(1900+uniform(gen)%200)+"-01-01"); break;
+            }
+        auto y=x;
+        vector<size_t> perm(x.size());
+        auto sortAny=time([&]{
+          for (size_t i=0; i<perm.size(); ++i) perm[i]=i;
+          sort(perm.begin(), perm.end(), [&](size_t i, size_t j){return diff(x[i],x[j])<0;});
+        }, 1);
+        auto build=time([&]{LabelColumn c(x);}, 1);
+        LabelColumn c(x);
+        auto sortColumn=time([&]{perm=c.sortPermutation();}, 1);
+        bool equal;
+        auto compare=time([&]{equal=x==y;});
+        size_t h=0;
+        auto hashAny=time([&]{for (auto& i: x) h+=std::hash<string>()(str(i));}, 1);
+        auto hashColumn=time([&]{for (size_t i=0; i<c.size(); ++i) h+=c.hash(i);}, 1);
+        cout << type << "\t" << build << "\t" << sortAny << "\t" << sortColumn << "\t" << compare
+             << (equal? "": "!") << "\t" << hashAny << "\t" << hashColumn << (h? "": " ") << endl;
+      }
+  }
+
+  /// compares memory and lookup throughput of compressed Index with a plain sorted vector
+  void index()
+  {
+    cout << "Index: 10M elements"<<endl;
+    cout << "mean gap\tvector bytes\tIndex bytes\tvector [](ns)\tIndex [](ns)\tvector lookup(ns)\tIndex lookup(ns)"<<endl;
+    const size_t n=10000000;
+    for (size_t gap: {size_t(2), size_t(20), size_t(2000), size_t(1)<<34})
+      {
+        mt19937_64 gen(1);
+        uniform_int_distribution<size_t> uniform(1,2*gap-1);
+        vector<size_t> indices(n);
+        for (size_t i=0, h=0; i<n; ++i, h+=uniform(gen)) indices[i]=h;
+        Index index{vector<size_t>(indices)};
+        vector<size_t> probes(1000000);
+        uniform_int_distribution<size_t> select(0,n-1);
+        for (auto& i: probes) i=indices[select(gen)]+(select(gen)&1);
+        size_t sum=0;
+        auto vectorSelect=time([&]{for (size_t i=0; i<n; ++i) sum+=indices[i];}, 1)*1000/n;
+        auto indexSelect=time([&]{for (size_t i=0; i<n; ++i) sum+=index[i];}, 1)*1000/n;
+        auto vectorLookup=time([&]{
+          for (auto h: probes)
+            {
+              auto lb=lower_bound(indices.begin(), indices.end(), h);
+              sum+=lb!=indices.end() && *lb==h? lb-indices.begin(): n;
+            }
+        }, 1)*1000/probes.size();
+        auto indexLookup=time([&]{for (auto h: probes) sum+=index.linealOffset(h);}, 1)*1000/probes.size();
+        cout << gap << "\t" << indices.size()*sizeof(size_t) << "\t" << index.memoryUsage() << "\t"
+             << vectorSelect << "\t" << indexSelect << "\t" << vectorLookup << "\t" << indexLookup
+             << (sum? "": " ") << endl;
+      }
+  }
+
+  /// per element cost of mapping hypercube indices through splitIndex/linealIndex versus MultiIndex
+  void multiIndex()
+  {
+    cout << "MultiIndex: pivoting rank 4 and 5 hypercubes"<<endl;
+    cout << "rank\tsplitIndex(ns)\tMultiIndex seek(ns)\tMultiIndex ++(ns)\tPivot setOrientation sparse(ns)\tPivot [](ns)"<<endl;
+    for (auto dims: {vector<unsigned>{20,30,40,50}, vector<unsigned>{10,12,14,16,18}})
+      {
+        Hypercube hc(dims), phc;
+        auto rank=hc.rank();
+        // reverse the axes
+        for (size_t k=rank; k>0; --k) phc.xvectors.push_back(hc.xvectors[k-1]);
+        auto n=hc.numElements();
+        size_t sum=0;
+        auto split=time([&]{
+          for (size_t i=0; i<n; ++i)
+            {
+              auto s=hc.splitIndex(i);
+              reverse(s.begin(), s.end());
+              sum+=phc.linealIndex(s);
+            }
+        }, 1)*1000/n;
+        MultiIndex idx(hc);
+        auto strides=phc.strides();
+        reverse(strides.begin(), strides.end());
+        idx.strides(strides);
+        auto seek=time([&]{for (size_t i=0; i<n; ++i) {idx.seek(i); sum+=idx.offset();}}, 1)*1000/n;
+        auto increment=time([&]{
+          idx.seek(0);
+          for (size_t i=0; i<n; ++i, ++idx) sum+=idx.offset();
+        }, 1)*1000/n;
+
+        auto arg=sparseTensor(dims, 0.1, 1);
+        vector<string> axes;
+        for (auto& i: phc.xvectors) axes.push_back(i.name);
+        Pivot pivot;
+        pivot.setArgument(arg);
+        auto setup=time([&]{pivot.setOrientation(axes);}, 1)*1000/arg->size();
+        auto dense=sparseTensor(dims, 1, 1);
+        pivot.setArgument(dense);
+        pivot.setOrientation(axes);
+        double x=0;
+        auto element=time([&]{for (size_t i=0; i<n; ++i) x+=pivot[i];}, 1)*1000/n;
+        cout << rank << "\t" << split << "\t" << seek << "\t" << increment << "\t" << setup << "\t" << element
+             << (sum && x? "": " ") << endl;
+      }
+  }
+
+  /// evaluation of a pivoted large dense cube, element by element, and materialised
+  void pivot()
+  {
+    cout << "Pivot: transposing 200x200x200 hypercube"<<endl;
+    cout << "orientation\telementwise(us)\tmaterialise(us)\tcached(us)"<<endl;
+    auto arg=sparseTensor({200,200,200}, 1, 1);
+    for (auto& orientation: vector<vector<string>>{{"1","0","2"}, {"2","1","0"}, {"1","2","0"}})
+      {
+        Pivot op;
+        op.setArgument(arg);
+        op.setOrientation(orientation);
+        vector<double> r(op.size());
+        auto elementwise=time([&]{for (size_t i=0; i<r.size(); ++i) r[i]=op[i];}, 1);
+        // updating the timestamp forces rematerialisation
+        auto materialise=time([&]{arg->updateTimestamp(); op.evaluate(r.data(),0,r.size());}, 3);
+        auto cached=time([&]{op.evaluate(r.data(),0,r.size());}, 3);
+        cout << orientation[0] << orientation[1] << orientation[2] << "\t" << elementwise << "\t"
+             << materialise << "\t" << cached << endl;
+      }
+  }
+
+  void scan()
+  {
+    cout << "Scan: running sum over 1000x2000 hypercube"<<endl;
+    cout << "axis\twindow\tinvertible(us)\tdirect(us)"<<endl;
+    auto arg=sparseTensor({1000,2000}, 1, 1);
+    auto sum=[](double& x,double y,size_t){x+=y;};
+    auto subtract=[](double& x,double y){
+      if (!isfinite(x) || !isfinite(y)) return false;
+      x-=y;
+      return true;
+    };
+    vector<double> r(arg->size());
+    for (auto axis: {"0","1"})
+      for (double window: {0,10,100})
+        {
+          Scan invertible(sum, subtract, arg, axis, window), direct(sum, arg, axis, window);
+          auto tInvertible=time([&]{arg->updateTimestamp(); invertible.evaluate(r.data(),0,r.size());}, 3);
+          auto tDirect=time([&]{arg->updateTimestamp(); direct.evaluate(r.data(),0,r.size());}, 3);
+          cout << axis << "\t" << window << "\t" << tInvertible << "\t" << tDirect << endl;
+        }
+  }
+
+  void interpolate()
+  {
+    cout << "InterpolateHC: interpolating 900x1100 hypercube onto 1000x1000"<<endl;
+    vector<XVector> argAxes, targetAxes;
+    for (auto& n: {"x","y"})
+      {
+        argAxes.emplace_back(n, Dimension{Dimension::value,""});
+        targetAxes.emplace_back(n, Dimension{Dimension::value,""});
+      }
+    for (size_t i=0; i<900; ++i) argAxes[0].push_back(i/900.0);
+    for (size_t i=0; i<1100; ++i) argAxes[1].push_back(i/1100.0);
+    for (size_t i=0; i<1000; ++i)
+      {
+        targetAxes[0].push_back(i/1000.0);
+        targetAxes[1].push_back(i/1000.0);
+      }
+    auto arg=make_shared<TensorVal>();
+    arg->hypercube(Hypercube(argAxes));
+    for (auto& i: *arg) i=1;
+    InterpolateHC op;
+    op.hypercube(Hypercube(targetAxes));
+    auto setup=time([&]{op.setArgument(arg);}, 1);
+    vector<double> r(op.size());
+    auto evaluate=time([&]{op.evaluate(r.data(),0,r.size());}, 3);
+    cout << "setup(us)\tevaluate(us)\tweights(bytes)"<<endl;
+    cout << setup << "\t" << evaluate << "\t" << op.memoryUsage() << endl;
+  }
+
+  void ravelChain()
+  {
+    cout << "Ravel: dragging slicer across 200x250x200 hypercube, 10% filled, sorted on axis 0"<<endl;
+    auto arg=sparseTensor({200,250,200}, 0.1, 1);
+    ravel::RavelState state;
+    for (auto& xv: arg->hypercube().xvectors)
+      {
+        state.handleStates.emplace_back();
+        state.handleStates.back().description=xv.name;
+      }
+    state.handleStates[0].order=ravel::HandleSort::reverse;
+    state.outputHandles={"2","0"};
+    auto& slicer=state.handleStates[1];
+    auto& labels=arg->hypercube().xvectors[1];
+    vector<double> r;
+    auto evaluate=[&](const vector<TensorPtr>& chain) {
+      r.resize(chain.back()->size());
+      chain.back()->evaluate(r.data(),0,r.size());
+    };
+    
+    size_t label=0;
+    auto drag=[&]{slicer.sliceLabel=str(labels[label++%labels.size()], labels.dimension.units);};
+    auto rebuild=time([&]{drag(); evaluate(createRavelChain(state, arg));}, 10);
+    RavelChain chain;
+    chain.update(state, arg);
+    auto update=time([&]{drag(); evaluate(chain.update(state, arg));}, 10);
+    cout << "rebuild(us)\tupdate(us)\tstages reused"<<endl;
+    cout << rebuild << "\t" << update << "\t" << chain.reused() << endl;
+  }
+}
+
+int main()
+{
+  binOp();
+  chain();
+  reduction();
+  fusion();
+  labels();
+  index();
+  multiIndex();
+  pivot();
+  scan();
+  interpolate();
+  ravelChain();
+  innerProduct();
+}
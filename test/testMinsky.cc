@@ -18,12 +18,28 @@
 */
 #include "minsky.h"
 #include "godleyTableWindow.h"
+#include "userFunction.h"
 #include "matrix.h"
 #include "minsky_epilogue.h"
 #include <UnitTest++/UnitTest++.h>
 #include <gsl/gsl_integration.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 using namespace minsky;
 
+// count heap allocations, for checking the simulation's inner loops
+// are allocation free
+namespace {std::atomic<size_t> numAllocations{0};}
+void* operator new(std::size_t n)
+{
+  ++numAllocations;
+  if (auto p=malloc(n)) return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept {free(p);}
+void operator delete(void* p, std::size_t) noexcept {free(p);}
+
 namespace
 {
   struct TestFixture: public Minsky
@@ -308,6 +324,239 @@ SUITE(Minsky)
       CHECK_EQUAL(1,jac(3,1));
       CHECK_EQUAL(0,jac(3,2));
       CHECK_EQUAL(0,jac(3,3));
+
+      // columns {c,e} and {d,\int} share no rows, so can be seeded together
+      CHECK_EQUAL(2, jacobianColours.size());
+      // check the dense calculation agrees with the coloured one
+      vector<double> jd(j.size());
+      Matrix denseJac(stockVars.size(),&jd[0]);
+      sparseJacobian=false;
+      computeJacobianSparsity();
+      CHECK(jacobianColours.empty());
+      evalJacobian(denseJac,t,&stockVars[0]);
+      CHECK_ARRAY_EQUAL(jd, j, j.size());
+
+      // check the compiled tape agrees with the EvalOpVector
+      CHECK(!tape.empty());
+      vector<double> r1(stockVars.size()), r2(stockVars.size());
+      evalEquations(&r1[0],t,&stockVars[0]);
+      evalTape=false;
+      evalEquations(&r2[0],t,&stockVars[0]);
+      CHECK_ARRAY_EQUAL(r2, r1, r1.size());
+    }
+
+  TEST_FIXTURE(TestFixture,allocationFreeRHS)
+    {
+      // dx/dt = c x
+      auto intOp=new IntOp;
+      model->addItem(intOp);
+      auto mul=model->addItem(OperationPtr(OperationType::multiply));
+      auto c=model->addItem(new VarConstant);
+      model->addWire(*intOp->intVar, *mul, 1);
+      model->addWire(*c, *mul, 2);
+      model->addWire(*mul, *intOp, 1);
+      implicit=true;
+      reset();
+
+      vector<double> result(stockVars.size()), j(stockVars.size()*stockVars.size());
+      Matrix jac(stockVars.size(),&j[0]);
+      for (bool useTape: {true, false})
+        {
+          evalTape=useTape;
+          evalEquations(&result[0],t,&stockVars[0]);
+          evalJacobian(jac,t,&stockVars[0]);
+          auto allocations=numAllocations.load();
+          for (int i=0; i<10; ++i)
+            {
+              evalEquations(&result[0],t,&stockVars[0]);
+              evalJacobian(jac,t,&stockVars[0]);
+            }
+          CHECK_EQUAL(allocations, numAllocations.load());
+        }
+    }
+
+  TEST_FIXTURE(TestFixture,parallelSchedule)
+    {
+      // independent equations dx_i/dt = c_i x_i
+      for (int i=0; i<10; ++i)
+        {
+          auto intOp=new IntOp;
+          model->addItem(intOp);
+          auto mul=model->addItem(OperationPtr(OperationType::multiply));
+          auto c=model->addItem(new VarConstant);
+          c->variableCast()->init(to_string(i));
+          model->addWire(*intOp->intVar, *mul, 1);
+          model->addWire(*c, *mul, 2);
+          model->addWire(*mul, *intOp, 1);
+        }
+      parallelEvalThreshold=1;
+      reset();
+      CHECK(schedule.width()>=2);
+      for (size_t i=0; i<stockVars.size(); ++i)
+        stockVars[i]=i+1;
+
+      vector<double> r1(stockVars.size()), r2(stockVars.size());
+      evalEquations(&r1[0],t,&stockVars[0]);
+      schedule.clear();
+      evalEquations(&r2[0],t,&stockVars[0]);
+      CHECK_ARRAY_EQUAL(r2, r1, r1.size());
+    }
+
+  TEST_FIXTURE(TestFixture,solverStats)
+    {
+      auto intOp=new IntOp;
+      model->addItem(intOp);
+      auto mul=model->addItem(OperationPtr(OperationType::multiply));
+      auto c=model->addItem(new VarConstant);
+      c->variableCast()->init("0.1");
+      model->addWire(*intOp->intVar, *mul, 1);
+      model->addWire(*c, *mul, 2);
+      model->addWire(*mul, *intOp, 1);
+      reset();
+
+      // nothing collected unless enabled
+      nSteps=10;
+      running=true;
+      step();
+      CHECK_EQUAL(0, solverStats.steps);
+      CHECK_EQUAL(0, solverStats.evalEquations.count);
+
+      solverStats.enabled=true;
+      step();
+      CHECK(solverStats.steps>0);
+      CHECK(solverStats.evalEquations.count>=solverStats.steps);
+      CHECK(solverStats.minStepSize>0);
+      CHECK(solverStats.minStepSize<=solverStats.maxStepSize);
+      CHECK_EQUAL(solverStats.evalEquations.count, solverStats.evalGodley.count);
+      CHECK(solverStats.opCost.empty());
+
+      // per operation costs are only collected on request
+      solverStats.opTiming=true;
+      step();
+      CHECK(solverStats.opCost.count(OperationType::typeName(OperationType::multiply)));
+
+      solverStats.clear();
+      CHECK(solverStats.enabled);
+      CHECK(solverStats.opTiming);
+      CHECK_EQUAL(0, solverStats.steps);
+    }
+
+  TEST_FIXTURE(TestFixture,solvers)
+    {
+      // integrate a constant twice
+      auto c=model->addItem(new VarConstant);
+      c->variableCast()->init("10");
+      auto int1=new IntOp, int2=new IntOp;
+      model->addItem(int1);
+      model->addItem(int2);
+      model->addWire(*c, *int1, 1);
+      model->addWire(*int1->intVar, *int2, 1);
+      nSteps=10;
+      epsAbs=epsRel=1e-8;
+      for (auto s: {Simulation::standard, Simulation::rkck, Simulation::rk8pd,
+            Simulation::bsimp, Simulation::msadams, Simulation::msbdf})
+        {
+          solver=s;
+          reset();
+          running=true;
+          step();
+          CHECK(t>t0);
+          CHECK_CLOSE(10*t, int1->intVar->value(), 1e-6);
+          CHECK_CLOSE(5*t*t, int2->intVar->value(), 1e-6);
+        }
+    }
+
+  TEST_FIXTURE(TestFixture,asyncStep)
+    {
+      // integrate a constant, with a flow variable depending on the integral
+      auto c=model->addItem(new VarConstant);
+      c->variableCast()->init("10");
+      auto intOp=new IntOp;
+      model->addItem(intOp);
+      auto mul=model->addItem(OperationPtr(OperationType::multiply));
+      auto f=model->addItem(VariablePtr(VariableType::flow,"f"));
+      model->addWire(*c, *intOp, 1);
+      model->addWire(*intOp->intVar, *mul, 1);
+      model->addWire(*c, *mul, 2);
+      model->addWire(*mul, *f, 1);
+      nSteps=10;
+      reset();
+      startStep();
+      startStep(); // ignored whilst a step is in progress
+      while (!stepComplete());
+      CHECK(t>t0);
+      CHECK_CLOSE(10*t, intOp->intVar->value(), 1e-6);
+      // flow variables are evaluated along with the step
+      CHECK_CLOSE(10*intOp->intVar->value(), f->variableCast()->value(), 1e-6);
+      CHECK(stepComplete());
+
+      // reset discards a step in progress
+      startStep();
+      reset();
+      while (!stepComplete());
+      CHECK_EQUAL(t0, t);
+    }
+
+  TEST_FIXTURE(TestFixture,userFunctionReadsStock)
+    {
+      // a user function referring to an integral by name, rather than by wire
+      auto c=model->addItem(new VarConstant);
+      c->variableCast()->init("10");
+      auto intOp=new IntOp;
+      model->addItem(intOp);
+      intOp->description("stock");
+      auto uf=model->addItem(new UserFunction("twice","2*stock"));
+      auto f=model->addItem(VariablePtr(VariableType::flow,"f"));
+      model->addWire(*c, *intOp, 1);
+      model->addWire(*uf, *f, 1);
+      reset();
+      for (int i=0; i<3; ++i)
+        {
+          step();
+          CHECK_CLOSE(10*t, intOp->intVar->value(), 1e-6);
+          CHECK_CLOSE(2*intOp->intVar->value(), f->variableCast()->value(), 1e-6);
+        }
+      startStep();
+      while (!stepComplete());
+      CHECK_CLOSE(2*intOp->intVar->value(), f->variableCast()->value(), 1e-6);
+    }
+
+  TEST_FIXTURE(TestFixture,evalProfile)
+    {
+      auto intOp=new IntOp;
+      model->addItem(intOp);
+      auto mul=model->addItem(OperationPtr(OperationType::multiply));
+      auto c=model->addItem(new VarConstant);
+      c->variableCast()->init("0.1");
+      model->addWire(*intOp->intVar, *mul, 1);
+      model->addWire(*c, *mul, 2);
+      model->addWire(*mul, *intOp, 1);
+      reset();
+      profiling=true;
+      nSteps=10;
+      running=true;
+      step();
+      CHECK(profile.size()>0);
+      CHECK(profile.totalTime()>0);
+
+      // every profiled item has been called, and the multiply is attributed to its item
+      bool foundMul=false;
+      for (auto& e: profile.sorted())
+        {
+          CHECK(e.stats.count>0);
+          foundMul|=e.item.lock()==mul;
+        }
+      CHECK(foundMul);
+      auto sorted=profile.sorted();
+      for (size_t i=1; i<sorted.size(); ++i)
+        CHECK(sorted[i-1].stats.totalTime>=sorted[i].stats.totalTime);
+
+      ostringstream csv, json;
+      profile.exportCSV(csv);
+      profile.exportJSON(json);
+      CHECK(csv.str().find("multiply")!=string::npos);
+      CHECK(json.str().find("\"item\":\"multiply")!=string::npos);
+      CHECK(canvasItemFor(*mul)==mul);
     }
 
   TEST_FIXTURE(TestFixture,integrals)
@@ -714,6 +963,77 @@ SUITE(Minsky)
     EvalOp<OperationType::frac> frac;
     CHECK_CLOSE(0.2,frac.evaluate(3.2,0),1e-6);
   }
+
+  // checks the tape's inline operations against EvalOp::evaluate
+  TEST(evalTape)
+  {
+    for (int op=0; op<OperationType::sum; ++op)
+      switch (op)
+        {
+        case OperationType::integrate:
+        case OperationType::differentiate:
+        case OperationType::ravel:
+          continue;
+        default:
+          {
+            EvalOpPtr e(OperationType::Type(op));
+            auto& s=dynamic_cast<ScalarEvalOp&>(*e);
+            if (auto c=dynamic_cast<ConstantEvalOp*>(&s))
+              c->value=3;
+            // fv[0]=x, sv[0]=y, output into fv[1..2]
+            s.out=1;
+            s.flow1=true; s.flow2=false;
+            if (s.numArgs()>0)
+              s.in1={0,0};
+            if (s.numArgs()>1)
+              s.in2={{{1,0}},{{0.5,0},{0.5,1}}};
+            double fv1[]={0.7,0,0}, fv2[]={0.7,0,0}, sv[]={2.5,1.5};
+            s.eval(fv1,3,sv);
+            EvalOpVector equations;
+            equations.push_back(e);
+            EvalTape tape;
+            tape.compile(equations);
+            tape.eval(fv2,3,sv);
+            cout << "checking tape "<<OperationType::typeName(op)<<endl;
+            CHECK_ARRAY_EQUAL(fv1, fv2, 3);
+          }
+        }
+  }
+
+  // checks the contiguous array evaluation against elementwise evaluation
+  TEST(evalOpContiguous)
+  {
+    for (int op=0; op<OperationType::sum; ++op)
+      switch (op)
+        {
+        case OperationType::integrate:
+        case OperationType::differentiate:
+        case OperationType::ravel:
+          continue;
+        default:
+          {
+            EvalOpPtr e(OperationType::Type(op));
+            auto& s=dynamic_cast<ScalarEvalOp&>(*e);
+            if (s.numArgs()==0) continue;
+            // fv[0..3] input 1, sv[0..3] input 2, output into fv[4..7]
+            double fv[8]={0.1,0.3,0.5,0.7}, sv[4]={0.2,0.4,0.6,0.8};
+            s.out=4;
+            s.flow1=true; s.flow2=false;
+            s.in1={0,1,2,3};
+            s.in2={{{1,0}},{{1,1}},{{1,2}},{{1,3}}};
+            CHECK(s.contiguousOperands());
+            s.eval(fv,8,sv);
+            for (int i=0; i<4; ++i)
+              CHECK_EQUAL(s.evaluate(fv[i], s.numArgs()>1? sv[i]: 0), fv[4+i]);
+            CHECK(s.useEvaluateArray());
+            // partially overlapping the output
+            s.in1={3,4,5,6};
+            CHECK(!s.contiguousOperands());
+            s.invalidateEvaluateArray();
+            CHECK(!s.useEvaluateArray());
+          }
+        }
+  }
   
   TEST_FIXTURE(TestFixture,multiGodleyRules)
     {
@@ -23,12 +23,19 @@
 #include "xvector.h"
 #include "userFunction.h"
 #include "minskyTensorOps.h"
+#include "interpolateHypercube.h"
+#include "contraction.h"
 #include "minsky.h"
 #include "minsky_epilogue.h"
 #include <UnitTest++/UnitTest++.h>
 using namespace minsky;
 
 #include <exception>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 #include <boost/date_time.hpp>
@@ -238,6 +245,86 @@ SUITE(TensorOps)
       }
     }
 
+  TEST(windowedScan)
+    {
+      // running window with an inverse should agree with recomputing each window
+      auto sum=[](double& x,double y,size_t){x+=y;};
+      auto arg=make_shared<TensorVal>(vector<unsigned>{3,1000});
+      for (size_t i=0; i<arg->size(); ++i)
+        (*arg)[i]=i%97==0? nan(""): i%13==0? 0: 1/double(i+1);
+      for (double window: {1,2,7,50})
+        {
+          civita::Scan running(sum, [](double& x,double y,double&) {
+              if (!std::isfinite(x) || !std::isfinite(y)) return false;
+              x-=y;
+              return true;
+            }, arg, "1", window);
+          civita::Scan direct(sum, arg, "1", window);
+          CHECK_EQUAL(direct.size(), running.size());
+          for (size_t i=0; i<direct.size(); ++i)
+            if (std::isnan(direct[i]))
+              CHECK(std::isnan(running[i]));
+            else
+              CHECK_CLOSE(direct[i], running[i], 1e-12);
+        }
+    }
+
+  TEST_FIXTURE(TestFixture, runningSumMixedMagnitudes)
+    {
+      // a large value leaving the window must not swamp the smaller terms
+      fromVal.hypercube(Hypercube(vector<unsigned>{40}));
+      for (auto& i: fromVal) i=1;
+      fromVal[3]=1e17;
+      fromVal[25]=-1e15;
+      const int window=10;
+      evalOp<OperationType::runningSum>("0",window);
+      auto& toVal=*to->vValue();
+      for (int i=0; i<int(fromVal.size()); ++i)
+        {
+          double ref=0;
+          for (int k=max(i-window+1,0); k<=i; ++k)
+            ref+=fromVal[k];
+          CHECK_CLOSE(ref,toVal[i],1e-12*fabs(ref));
+        }
+      CHECK_EQUAL(10,toVal[13]);
+      CHECK_EQUAL(10,toVal[24]);
+      CHECK_EQUAL(10,toVal[39]);
+    }
+
+  TEST(interpolateHC)
+    {
+      XVector x("x",{Dimension::value,""});
+      XVector y("y",{Dimension::string,""},{"a","b"});
+      for (double i: {2,0,1}) x.push_back(i);
+      auto arg=make_shared<TensorVal>();
+      arg->hypercube(Hypercube(vector<XVector>{x,y}));
+      for (size_t i=0; i<arg->size(); ++i) (*arg)[i]=10*i;
+
+      // target axes rotated, and x interpolated, extrapolated and exact
+      XVector tx("x",{Dimension::value,""});
+      for (double i: {0.5,1.0,3.0,-1.0,1.25}) tx.push_back(i);
+      InterpolateHC interpolate;
+      interpolate.hypercube(Hypercube(vector<XVector>{y,tx}));
+      interpolate.setArgument(arg);
+      CHECK_EQUAL(10, interpolate.size());
+      // x=0,1,2 are at arg offsets 1,2,0
+      vector<double> expected={15,45,20,50,0,30,10,40,15,45};
+      for (size_t i=0; i<expected.size(); ++i)
+        CHECK_CLOSE(expected[i], interpolate[i], 1e-10);
+      vector<double> result(interpolate.size());
+      interpolate.evaluate(result.data(),0,result.size());
+      CHECK_ARRAY_CLOSE(expected, result, expected.size(), 1e-10);
+      // short ranges are evaluated elementwise
+      for (size_t i=0; i<expected.size(); ++i)
+        {
+          double r;
+          interpolate.evaluate(&r,i,i+1);
+          CHECK_CLOSE(expected[i], r, 1e-10);
+        }
+      // weights are stored per axis, not per element
+      CHECK(interpolate.memoryUsage()<20*sizeof(double)*(x.size()+y.size()+tx.size()));
+    }
+
   TEST_FIXTURE(TestFixture, difference2D)
     {
       vector<unsigned> dims{5,5};
@@ -292,6 +379,11 @@ SUITE(TensorOps)
         CHECK_EQUAL(2,i);
       CHECK_EQUAL(2, any_cast<double>(to->vValue()->hypercube().xvectors[0][0]));
 
+      // lag spanning the whole axis gives an empty result
+      evalOp<OperationType::difference>("",delta=5);
+      CHECK_EQUAL(0, to->vValue()->hypercube().dims()[0]);
+      CHECK_EQUAL(0, to->vValue()->size());
+
       // check that the sparse code works as expected
       fromVal.index({0,1,2,3,4});
       evalOp<OperationType::difference>("",delta=1);
@@ -891,6 +983,44 @@ SUITE(TensorOps)
       CHECK_ARRAY_CLOSE(expected, result->vValue()->begin(), 7, 0.001);
     }
 
+  TEST_FIXTURE(MinskyFixture, fusedElementWise)
+    {
+      VariablePtr x1(VariableType::parameter,"x1"), x2(VariableType::parameter,"x2");
+      model->addItem(x1); model->addItem(x2);
+      auto& x1Val=*x1->vValue();
+      auto& x2Val=*x2->vValue();
+      Hypercube hc({7});
+      x1Val.hypercube(hc);
+      x2Val.hypercube(hc);
+      x1Val={1,2,2,1,3,2,1};
+      x2Val={3,4,5,6,7,8,2};
+      // exp(x1*x2+x1)
+      OperationPtr multiply(OperationType::multiply), add(OperationType::add), exp(OperationType::exp);
+      model->addItem(multiply); model->addItem(add); model->addItem(exp);
+      VariablePtr result(VariableType::flow,"result");
+      model->addItem(result);
+      Wire w1(x1->ports(0),multiply->ports(1));
+      Wire w2(x2->ports(0),multiply->ports(2));
+      Wire w3(multiply->ports(0),add->ports(1));
+      Wire w4(x1->ports(0),add->ports(2));
+      Wire w5(add->ports(0),exp->ports(1));
+      Wire w6(exp->ports(0), result->ports(1));
+      auto ev=make_shared<EvalCommon>();
+      auto rhs=tensorOpFactory.create(exp,TensorsFromPort(ev));
+      auto fused=dynamic_pointer_cast<civita::FusedElementWiseOp>(rhs);
+      CHECK(fused);
+      if (fused)
+        CHECK_EQUAL(6, fused->programSize()); // 3 leaves, 3 operations
+      TensorEval eval(variableValues[":result"], ev, rhs);
+      eval.eval(ValueVector::flowVars.data(), ValueVector::flowVars.size(), ValueVector::stockVars.data());
+      CHECK_EQUAL(x1Val.size(),result->vValue()->size());
+      for (size_t i=0; i<x1Val.size(); ++i)
+        {
+          CHECK_CLOSE(std::exp(x1Val[i]*x2Val[i]+x1Val[i]), result->vValue()->value(i), 1e-6*result->vValue()->value(i));
+          CHECK_EQUAL((*rhs)[i], result->vValue()->value(i));
+        }
+    }
+
   TEST_FIXTURE(MinskyFixture, binOpInterpolation1D)
     {
       // same example as examples/binaryInterpolation.mky
@@ -1139,6 +1269,59 @@ SUITE(TensorOps)
       CHECK_ARRAY_EQUAL(dims, chain.back()->shape(), 2);
     }
 
+  TEST_FIXTURE(TensorValFixture, incrementalRavelChain)
+    {
+      state.outputHandles={"date","country"};
+      auto country=find_if(state.handleStates.begin(), state.handleStates.end(),
+                           [](const ravel::HandleState& i){return i.description=="country";});
+      country->order=ravel::HandleSort::reverse;
+      auto sex=find_if(state.handleStates.begin(), state.handleStates.end(),
+                       [](const ravel::HandleState& i){return i.description=="sex";});
+      sex->sliceLabel="male";
+      arg->index({0,4,8,12,16});
+
+      auto checkChain=[&](const vector<TensorPtr>& chain) {
+        auto expected=createRavelChain(state, arg);
+        CHECK_EQUAL(expected.size(), chain.size());
+        CHECK(expected.back()->hypercube()==chain.back()->hypercube());
+        CHECK_EQUAL(expected.back()->size(), chain.back()->size());
+        CHECK_ARRAY_EQUAL(expected.back()->index(), chain.back()->index(), chain.back()->size());
+        CHECK_ARRAY_EQUAL(*expected.back(), *chain.back(), chain.back()->size());
+      };
+      
+      RavelChain ravelChain;
+      ravelChain.update(state, arg);
+      CHECK_EQUAL(0, ravelChain.reused());
+      checkChain(ravelChain.chain());
+
+      // dragging the slicer only rebuilds the slice and pivot
+      auto sort=ravelChain.chain()[1];
+      sex->sliceLabel="female";
+      ravelChain.update(state, arg);
+      CHECK_EQUAL(1, ravelChain.reused());
+      CHECK(sort==ravelChain.chain()[1]);
+      checkChain(ravelChain.chain());
+
+      // new values for the same shape of argument are passed through
+      auto newArg=make_shared<TensorVal>(*arg);
+      for (size_t i=0; i<newArg->size(); ++i) (*newArg)[i]=10*i;
+      arg=newArg;
+      ravelChain.update(state, arg);
+      CHECK_EQUAL(3, ravelChain.reused());
+      checkChain(ravelChain.chain());
+
+      // but a change of shape rebuilds the chain
+      arg->index({0,4,8,12});
+      ravelChain.update(state, arg);
+      CHECK_EQUAL(0, ravelChain.reused());
+      checkChain(ravelChain.chain());
+
+      country->order=ravel::HandleSort::forward;
+      ravelChain.update(state, arg);
+      CHECK_EQUAL(0, ravelChain.reused());
+      checkChain(ravelChain.chain());
+    }
+
   TEST_FIXTURE(TensorValFixture, imposeDimensions)
     {
       Dimensions dimensions;
@@ -1176,6 +1359,192 @@ SUITE(TensorOps)
       CHECK_EQUAL(expected[i], boost::any_cast<double>(reverse.hypercube().xvectors[0][i]));
   }
 
+  namespace
+  {
+    struct CountingCachedOp: public civita::CachedTensorOp
+    {
+      TensorPtr arg;
+      mutable unsigned numComputes=0;
+      CountingCachedOp(const TensorPtr& arg): arg(arg) {cachedResult.hypercube(arg->hypercube());}
+      void computeTensor() const override {
+        ++numComputes;
+        for (size_t i=0; i<cachedResult.size(); ++i) cachedResult[i]=2*(*arg)[i];
+      }
+      Timestamp timestamp() const override {return arg->timestamp();}
+    };
+  }
+  
+  TEST_FIXTURE(MinskyFixture, cachedOpInvalidation)
+  {
+    auto param=make_shared<VariableValue>(VariableType::parameter,":p");
+    auto flow=make_shared<VariableValue>(VariableType::flow,":f");
+    param->hypercube(Hypercube(vector<unsigned>{5}));
+    flow->hypercube(Hypercube(vector<unsigned>{5}));
+    for (size_t i=0; i<5; ++i)
+      (*param)[i]=(*flow)[i]=i;
+
+    auto ev=make_shared<EvalCommon>();
+    CountingCachedOp paramOp(make_shared<ConstTensorVarVal>(param,ev)),
+      flowOp(make_shared<ConstTensorVarVal>(flow,ev));
+    // each step of a run reevaluates the expression
+    const unsigned numSteps=10;
+    for (unsigned step=0; step<numSteps; ++step)
+      {
+        ev->update(ValueVector::flowVars.data(), ValueVector::flowVars.size(), ValueVector::stockVars.data());
+        for (size_t i=0; i<5; ++i)
+          {
+            CHECK_EQUAL(2*i, paramOp[i]);
+            CHECK_EQUAL(2*i, flowOp[i]);
+          }
+      }
+    // parameters are only computed once, flow variables every step
+    CHECK_EQUAL(1, paramOp.numComputes);
+    CHECK_EQUAL(numSteps, flowOp.numComputes);
+
+    // changing the parameter invalidates its cache
+    (*param)[2]=7;
+    CHECK_EQUAL(14, paramOp[2]);
+    CHECK_EQUAL(2, paramOp.numComputes);
+    CHECK_EQUAL(14, paramOp[2]);
+    CHECK_EQUAL(2, paramOp.numComputes);
+
+    // as does updating a TensorVal's timestamp
+    auto val=make_shared<TensorVal>(vector<unsigned>{5});
+    CountingCachedOp valOp(val);
+    valOp[0]; valOp[1];
+    CHECK_EQUAL(1, valOp.numComputes);
+    (*val)[1]=3;
+    val->updateTimestamp();
+    CHECK_EQUAL(6, valOp[1]);
+    CHECK_EQUAL(2, valOp.numComputes);
+
+    // and time, only when it changes
+    EvalOpBase::t=1;
+    CountingCachedOp timeOp(tensorOpFactory.create(OperationPtr(OperationType::time)));
+    CHECK_EQUAL(2, timeOp[0]);
+    CHECK_EQUAL(2, timeOp[0]);
+    CHECK_EQUAL(1, timeOp.numComputes);
+    EvalOpBase::t=2;
+    CHECK_EQUAL(4, timeOp[0]);
+    CHECK_EQUAL(2, timeOp.numComputes);
+    EvalOpBase::t=0;
+  }
+
+  TEST(binOpEvaluate)
+  {
+    auto a=make_shared<TensorVal>(vector<unsigned>{10,10});
+    auto b=make_shared<TensorVal>(vector<unsigned>{10,10});
+    auto dense=make_shared<TensorVal>(vector<unsigned>{10,10});
+    auto scalar=make_shared<TensorVal>(2.0);
+    *a=map<size_t,double>{{1,1},{5,2},{7,3},{50,4}};
+    *b=map<size_t,double>{{0,10},{5,20},{50,30},{99,40}};
+    for (size_t i=0; i<dense->size(); ++i) (*dense)[i]=i;
+
+    auto check=[](const BinOp& op, size_t begin, size_t end) {
+      vector<double> r(end-begin);
+      op.evaluate(r.data(), begin, end);
+      for (size_t i=begin; i<end; ++i)
+        if (isnan(op[i]))
+          CHECK(isnan(r[i-begin]));
+        else
+          CHECK_EQUAL(op[i], r[i-begin]);
+    };
+
+    BinOp sparse([](double x,double y){return x+y;}, a, b);
+    vector<size_t> expectedIndex{0,1,5,7,50,99};
+    CHECK_ARRAY_EQUAL(expectedIndex, sparse.index(), expectedIndex.size());
+    check(sparse, 0, sparse.size());
+    check(sparse, 2, 5);
+    BinOp sparseDense([](double x,double y){return x*y;}, dense, b);
+    CHECK_EQUAL(b->size(), sparseDense.size());
+    check(sparseDense, 0, sparseDense.size());
+    BinOp broadcast([](double x,double y){return x*y;}, scalar, a);
+    check(broadcast, 0, broadcast.size());
+    BinOp denseDense([](double x,double y){return x-y;}, dense, dense);
+    check(denseDense, 0, denseDense.size());
+  }
+
+  TEST(bulkEvaluate)
+  {
+    auto dense=make_shared<TensorVal>(vector<unsigned>{20,5,7});
+    auto sparse=make_shared<TensorVal>(vector<unsigned>{20,5,7});
+    for (size_t i=0; i<dense->size(); ++i) (*dense)[i]=i;
+    map<size_t,double> sparseData;
+    for (size_t i=0; i<dense->size(); i+=3) sparseData[i]=i;
+    *sparse=sparseData;
+
+    // evaluate must agree with operator[], over the whole tensor and part of it
+    auto check=[](const ITensor& op) {
+      auto n=op.size();
+      for (auto range: vector<pair<size_t,size_t>>{{0,n},{n/3,n},{1,n/4+1}})
+        {
+          vector<double> r(range.second-range.first);
+          op.evaluate(r.data(), range.first, range.second);
+          for (size_t i=range.first; i<range.second; ++i)
+            if (isnan(op[i]))
+              CHECK(isnan(r[i-range.first]));
+            else
+              CHECK_EQUAL(op[i], r[i-range.first]);
+        }
+    };
+
+    for (auto& arg: {dense, sparse})
+      {
+        check(*arg);
+        check(ElementWiseOp([](double x){return 2*x;}, arg));
+        check(BinOp([](double x,double y){return x+y;}, arg, dense));
+        check(BinOp([](double x,double y){return x*y;}, arg, make_shared<TensorVal>(3.0)));
+        for (auto axis: {"0","1","2"})
+          {
+            Sum sum; sum.setArgument(arg,axis,0); check(sum);
+            Average av; av.setArgument(arg,axis,0); check(av);
+            Slice slice; slice.setArgument(arg,axis,2); check(slice);
+            PermuteAxis permute; permute.setArgument(arg,axis);
+            permute.setPermutation({3,1,0}); check(permute);
+          }
+        Pivot pivot; pivot.setArgument(arg); pivot.setOrientation({"2","0"}); check(pivot);
+      }
+  }
+
+  TEST(sparseReduction)
+  {
+    // 3x4 tensor with elements
+    // 1 . 2 .
+    // . 3 . .
+    // 4 . NaN 5
+    auto arg=make_shared<TensorVal>(vector<unsigned>{3,4});
+    *arg=map<size_t,double>{{0,1},{2,4},{4,3},{6,2},{8,nan("")},{11,5}};
+    // reduce along axis 0
+    Sum sum0; sum0.setArgument(arg,"0",0);
+    vector<size_t> expectedIndex{0,1,2,3};
+    CHECK_ARRAY_EQUAL(expectedIndex, sum0.index(), 4);
+    vector<double> expected{5,3,2,5}, r(sum0.size());
+    sum0.evaluate(r.data(),0,r.size());
+    CHECK_ARRAY_EQUAL(expected, r, 4);
+    for (size_t i=0; i<expected.size(); ++i)
+      CHECK_EQUAL(expected[i], sum0[i]);
+    // reduce along axis 1
+    Sum sum1; sum1.setArgument(arg,"1",0);
+    expected={3,3,9};
+    r.resize(sum1.size());
+    sum1.evaluate(r.data(),0,r.size());
+    CHECK_ARRAY_EQUAL(expected, r, 3);
+    Average av; av.setArgument(arg,"1",0);
+    expected={1.5,3,4.5};
+    av.evaluate(r.data(),0,r.size());
+    CHECK_ARRAY_CLOSE(expected, r, 3, 1e-10);
+    CHECK_CLOSE(4.5, av[2], 1e-10);
+    StdDeviation sd; sd.setArgument(arg,"1",0);
+    expected={0.5,0,0.5};
+    sd.evaluate(r.data(),0,r.size());
+    CHECK_ARRAY_CLOSE(expected, r, 3, 1e-10);
+    CHECK_CLOSE(0.5, sd[0], 1e-10);
+    // reduce all
+    Sum all; all.setArgument(arg,"",0);
+    CHECK_EQUAL(1, all.size());
+    CHECK_EQUAL(15, all[0]);
+  }
+
   TEST(tensorValVectorIndex)
   {
     TensorVal tv(vector<unsigned>{5,3,2});
@@ -1328,6 +1697,286 @@ SUITE(TensorOps)
     CHECK_ARRAY_EQUAL(expected, hc.dimLabels(), expected.size());
   }
 
+  TEST(innerProduct)
+  {
+    OperationPtr inner{OperationType::innerProduct};
+    auto op=TensorOpFactory().create(inner);
+    // rank 3 by rank 2, with a sparse first argument
+    auto a=make_shared<TensorVal>(vector<unsigned>{2,2,3});
+    auto b=make_shared<TensorVal>(vector<unsigned>{3,4});
+    map<size_t,double> aData;
+    for (size_t i=0; i<12; i+=2) aData[i]=i+1;
+    *a=aData;
+    for (size_t i=0; i<b->size(); ++i) (*b)[i]=i%5;
+    op->setArguments(a,b);
+    CHECK_EQUAL(3, op->rank());
+    CHECK_EQUAL(16, op->size());
+    for (size_t i=0; i<4; ++i)
+      for (size_t j=0; j<4; ++j)
+        {
+          double expected=0;
+          for (size_t p=0; p<3; ++p)
+            {
+              auto x=a->atHCIndex(i+4*p);
+              if (!isnan(x)) expected+=x*(*b)[p+3*j];
+            }
+          CHECK_EQUAL(expected, (*op)[i+4*j]);
+        }
+
+    // contract over a named dimension
+    auto c=make_shared<TensorVal>(vector<unsigned>{3,2});
+    Hypercube hc({3,2});
+    hc.xvectors[1].name="j";
+    auto d=make_shared<TensorVal>(hc);
+    for (size_t i=0; i<6; ++i) {(*c)[i]=i; (*d)[i]=i+1;}
+    op->setArguments(c,d,"0");
+    CHECK_EQUAL(2, op->rank());
+    CHECK_EQUAL("1", op->hypercube().xvectors[0].name);
+    CHECK_EQUAL("j", op->hypercube().xvectors[1].name);
+    for (size_t i=0; i<2; ++i)
+      for (size_t j=0; j<2; ++j)
+        {
+          double expected=0;
+          for (size_t p=0; p<3; ++p)
+            expected+=(*c)[p+3*i]*(*d)[p+3*j];
+          CHECK_EQUAL(expected, (*op)[i+2*j]);
+        }
+
+    CHECK_THROW(op->setArguments(c,b), std::exception);
+
+    // contracting over an empty dimension gives zeros
+    auto e=make_shared<TensorVal>(vector<unsigned>{3,0}), f=make_shared<TensorVal>(vector<unsigned>{0,4});
+    op->setArguments(e,f);
+    CHECK_EQUAL(12, op->size());
+    for (size_t i=0; i<op->size(); ++i)
+      CHECK_EQUAL(0, (*op)[i]);
+  }
+
+  TEST(contraction)
+  {
+    size_t m=40, k=30, n=20;
+    auto a=make_shared<TensorVal>(vector<unsigned>{unsigned(m),unsigned(k)});
+    auto b=make_shared<TensorVal>(vector<unsigned>{unsigned(k),unsigned(n)});
+    for (size_t i=0; i<a->size(); ++i) (*a)[i]=i%7? 0.5*i: nan("");
+    for (size_t i=0; i<b->size(); ++i) (*b)[i]=i%3-1.0;
+    // few enough elements to be stored in compressed sparse column form
+    auto sa=make_shared<TensorVal>(), sb=make_shared<TensorVal>();
+    sa->hypercube(a->hypercube());
+    sb->hypercube(b->hypercube());
+    map<size_t,double> saData, sbData;
+    for (size_t i=0; i<a->size(); i+=11) saData[i]=i+1;
+    saData[5]=nan("");
+    for (size_t i=0; i<b->size(); i+=13) sbData[i]=1.0-i;
+    *sa=saData;
+    *sb=sbData;
+
+    auto check=[&](const ITensor& x, const ITensor& y, unsigned threads) {
+      vector<double> c(m*n, -1);
+      civita::contract(m, k, n, x, y, c.data(), threads);
+      for (size_t i=0; i<m; ++i)
+        for (size_t j=0; j<n; ++j)
+          {
+            double expected=0;
+            for (size_t p=0; p<k; ++p)
+              {
+                double xv=x.atHCIndex(i+m*p), yv=y.atHCIndex(p+k*j);
+                if (!isnan(xv) && !isnan(yv)) expected+=xv*yv;
+              }
+            CHECK_CLOSE(expected, c[i+m*j], 1e-9*fabs(expected));
+          }
+    };
+    for (unsigned threads: {1,4})
+      {
+        check(*a,*b,threads);
+        check(*sa,*b,threads);
+        check(*a,*sb,threads);
+        check(*sa,*sb,threads);
+      }
+  }
+  
+  TEST(sparseSpreadIndex)
+  {
+    auto arg=make_shared<TensorVal>(vector<unsigned>{5});
+    *arg=map<size_t,double>{{1,10},{3,30}};
+    Hypercube spread({2});
+    spread.xvectors[0].name="s";
+    SpreadLast last;
+    last.setArgument(arg);
+    last.setSpreadDimensions(spread);
+    vector<size_t> expectedIndex{1,3,6,8};
+    CHECK_EQUAL(expectedIndex.size(), last.size());
+    CHECK_ARRAY_EQUAL(expectedIndex, last.index(), expectedIndex.size());
+    vector<double> expected{10,30,10,30};
+    for (size_t i=0; i<expected.size(); ++i)
+      CHECK_EQUAL(expected[i], last[i]);
+    SpreadFirst first;
+    first.setArgument(arg);
+    first.setSpreadDimensions(spread);
+    expectedIndex={2,3,6,7};
+    CHECK_EQUAL(expectedIndex.size(), first.size());
+    CHECK_ARRAY_EQUAL(expectedIndex, first.index(), expectedIndex.size());
+    expected={10,10,30,30};
+    for (size_t i=0; i<expected.size(); ++i)
+      CHECK_EQUAL(expected[i], first[i]);
+  }
+
+  TEST(compressedIndex)
+  {
+    size_t n=Index::compressionThreshold+1000;
+    // strides requiring 16 bit, 32 bit and full width deltas
+    for (size_t stride: {size_t(3), size_t(1000), size_t(1)<<33})
+      {
+        vector<size_t> indices;
+        for (size_t i=0; i<n; ++i) indices.push_back(i*stride+7);
+        Index index{vector<size_t>(indices)};
+        CHECK_EQUAL(n, index.size());
+        CHECK_EQUAL(stride<(size_t(1)<<32), index.compressed());
+        if (index.compressed())
+          CHECK(index.memoryUsage() < n*sizeof(size_t)/(stride<100? 3: 1.9));
+        CHECK(index.sorted());
+        CHECK_ARRAY_EQUAL(indices, index, n);
+        CHECK(equal(indices.begin(), indices.end(), index.begin(), index.end()));
+        for (size_t i=0; i<n; i+=97)
+          {
+            CHECK_EQUAL(i, index.linealOffset(indices[i]));
+            CHECK_EQUAL(n, index.linealOffset(indices[i]+1));
+          }
+        CHECK_EQUAL(n-1, index.linealOffset(indices.back()));
+        CHECK_EQUAL(n, index.linealOffset(0));
+        CHECK_EQUAL(n, index.linealOffset(indices.back()+1));
+
+        Index fromSet{set<size_t>(indices.begin(), indices.end())};
+        CHECK_ARRAY_EQUAL(indices, fromSet, n);
+        map<size_t,double> data;
+        for (auto i: indices) data[i]=1;
+        Index fromMap(data);
+        CHECK_ARRAY_EQUAL(indices, fromMap, n);
+        CHECK_EQUAL(index.compressed(), fromMap.compressed());
+      }
+    // small indices are left uncompressed
+    Index small(vector<size_t>{1,3,5});
+    CHECK(!small.compressed());
+    CHECK_EQUAL(1, small.linealOffset(3));
+  }
+
+  TEST(multiIndex)
+  {
+    Hypercube hc(vector<unsigned>{3,4,2,5});
+    MultiIndex idx(hc);
+    // offset into a hypercube with axes permuted {2,0,3,1}
+    Hypercube phc(vector<unsigned>{2,3,5,4});
+    vector<size_t> perm{2,0,3,1}, pStrides(4);
+    auto strides=phc.strides();
+    for (size_t k=0; k<4; ++k) pStrides[perm[k]]=strides[k];
+    idx.strides(pStrides);
+    for (size_t i=0; i<hc.numElements(); ++i, ++idx)
+      {
+        CHECK_EQUAL(i, idx.lineal());
+        auto split=hc.splitIndex(i);
+        CHECK_ARRAY_EQUAL(split, idx.splitIndex(), 4);
+        vector<size_t> pSplit(4);
+        for (size_t k=0; k<4; ++k) pSplit[k]=split[perm[k]];
+        CHECK_EQUAL(phc.linealIndex(pSplit), idx.offset());
+      }
+    idx.seek(37);
+    CHECK_EQUAL(37, idx.lineal());
+    CHECK_ARRAY_EQUAL(hc.splitIndex(37), idx.splitIndex(), 4);
+    // default strides give the lineal index
+    MultiIndex lineal(hc, 53);
+    CHECK_EQUAL(53, lineal.offset());
+    CHECK_EQUAL(54, (++lineal).offset());
+    // a zero length axis has no positions to divide the index between
+    Hypercube empty(vector<unsigned>{3,0,2});
+    MultiIndex emptyIdx(empty, 5);
+    CHECK_EQUAL(0, emptyIdx.offset());
+    CHECK_EQUAL(3, emptyIdx.rank());
+    emptyIdx.strides({1,0,3});
+    CHECK_EQUAL(0, emptyIdx.offset());
+  }
+
+  TEST(materialisedPivot)
+  {
+    auto arg=make_shared<TensorVal>(vector<unsigned>{40,3,50,2});
+    for (size_t i=0; i<arg->size(); ++i) (*arg)[i]=i;
+    arg->updateTimestamp();
+    auto& ahc=arg->hypercube();
+    Pivot pivot;
+    pivot.setArgument(arg);
+    pivot.setOrientation({"2","3","0","1"});
+    PermuteAxis permute;
+    permute.setArgument(arg,"0");
+    vector<size_t> permutation;
+    for (size_t i=40; i>0; i-=2) permutation.push_back(i-1);
+    permute.setPermutation(permutation);
+    for (int step=0; step<2; ++step)
+      {
+        vector<double> r(pivot.size());
+        pivot.evaluate(r.data(), 0, r.size());
+        for (size_t i=0; i<r.size(); ++i)
+          {
+            auto s=pivot.hypercube().splitIndex(i);
+            CHECK_EQUAL((*arg)[ahc.linealIndex(vector<size_t>{s[2],s[3],s[0],s[1]})], r[i]);
+            CHECK_EQUAL(r[i], pivot[i]);
+          }
+        r.resize(permute.size());
+        permute.evaluate(r.data(), 0, r.size());
+        for (size_t i=0; i<r.size(); ++i)
+          {
+            auto s=permute.hypercube().splitIndex(i);
+            s[0]=permutation[s[0]];
+            CHECK_EQUAL((*arg)[ahc.linealIndex(s)], r[i]);
+            CHECK_EQUAL(r[i], permute[i]);
+          }
+        // cached output is refreshed when the argument changes
+        for (size_t i=0; i<arg->size(); ++i) (*arg)[i]*=-1;
+        arg->updateTimestamp();
+      }
+  }
+
+#ifdef __linux__
+  TEST(outerProductIndexMemory)
+  {
+    // peak resident set size, in bytes
+    auto maxRSS=[]() {
+      rusage r;
+      getrusage(RUSAGE_SELF, &r);
+      return size_t(r.ru_maxrss)*1024;
+    };
+    auto sparseVector=[](size_t n, size_t stride) {
+      auto r=make_shared<TensorVal>(vector<unsigned>{unsigned(n*stride)});
+      map<size_t,double> data;
+      for (size_t i=0; i<n; ++i) data[i*stride]=1;
+      *r=data;
+      return r;
+    };
+    auto a=sparseVector(2000,50), b=sparseVector(1000,100);
+    size_t expectedSize=a->size()*b->size();
+    OperationPtr outer{OperationType::outerProduct};
+    // the peak RSS is a high water mark for the whole process, so the
+    // index is built in a child process, whose peak starts afresh
+    auto pid=fork();
+    if (pid==0)
+      {
+        auto initialRSS=maxRSS();
+        auto op=TensorOpFactory().create(outer);
+        op->setArguments(a,b);
+        bool ok=op->size()==expectedSize &&
+          is_sorted(op->index().begin(), op->index().end()) &&
+          op->index().memoryUsage()<=expectedSize*sizeof(size_t) &&
+          // the index and the cached data of 2 million elements each
+          // need 32MB. Building the index via a std::set needed
+          // several times that.
+          maxRSS()-initialRSS < 4*expectedSize*sizeof(size_t);
+        _exit(!ok);
+      }
+    CHECK(pid>0);
+    int status=-1;
+    waitpid(pid, &status, 0);
+    CHECK(WIFEXITED(status));
+    CHECK_EQUAL(0, WEXITSTATUS(status));
+  }
+#endif
+  
   struct OuterFixture: public MinskyFixture
   {
     VariablePtr x{VariableType::parameter,"x"};
@@ -156,4 +156,65 @@ SUITE(XVector)
     x.push_back("2020-09-03T03:05:01");
     CHECK_EQUAL("%Y",x.timeFormat());
  }
+
+  TEST(labelColumn)
+  {
+    XVector strings("s",{Dimension::string,""},{"foo","bar","foo","baz","ba"});
+    XVector values("v",{Dimension::value,""},{"3","-1","2.5","3","0"});
+    XVector times("t",{Dimension::time,""},
+                  {"2000-03-01","1999-01-01","2000-01-01","2000-03-01"});
+    for (auto* x: {&strings,&values,&times})
+      {
+        LabelColumn c(*x);
+        CHECK_EQUAL(x->size(), c.size());
+        CHECK(x->dimension.type==c.type());
+        for (size_t i=0; i<x->size(); ++i)
+          {
+            CHECK_EQUAL(str((*x)[i]), str(c[i]));
+            for (size_t j=0; j<x->size(); ++j)
+              {
+                auto d=diff((*x)[i],(*x)[j]);
+                CHECK_EQUAL((d>0)-(d<0), (c.compare(i,j)>0)-(c.compare(i,j)<0));
+                if (d==0)
+                  CHECK_EQUAL(c.hash(i), c.hash(j));
+              }
+          }
+        auto perm=c.sortPermutation();
+        for (size_t i=1; i<perm.size(); ++i)
+          CHECK(diff((*x)[perm[i-1]],(*x)[perm[i]])<0 ||
+                (diff((*x)[perm[i-1]],(*x)[perm[i]])==0 && perm[i-1]<perm[i]));
+        perm=c.sortPermutation(true);
+        for (size_t i=1; i<perm.size(); ++i)
+          CHECK(diff((*x)[perm[i-1]],(*x)[perm[i]])>=0);
+      }
+    // hash depends only on label value
+    XVector other("s",{Dimension::string,""},{"baz"});
+    CHECK_EQUAL(LabelColumn(strings).hash(3), LabelColumn(other).hash(0));
+  }
+
+  TEST(labelOffset)
+  {
+    XVector x("x",{Dimension::string,""},{"foo","bar","baz","bar"});
+    CHECK_EQUAL(0, x.offset("foo"));
+    CHECK_EQUAL(1, x.offset("bar"));
+    CHECK_EQUAL(2, x.offset("baz"));
+    CHECK_EQUAL(x.size(), x.offset("qux"));
+    x.push_back("qux");
+    CHECK_EQUAL(4, x.offset("qux"));
+    x[0]=std::string("quux"); // in place modification
+    CHECK_EQUAL(x.size(), x.offset("foo"));
+    x.invalidateIndex();
+    CHECK_EQUAL(0, x.offset("quux"));
+    auto y=x;
+    CHECK_EQUAL(4, y.offset("qux"));
+    // copies share the index until one of them rebuilds it
+    y[1]=std::string("corge");
+    CHECK_EQUAL(3, y.offset("bar"));
+    CHECK_EQUAL(1, x.offset("bar"));
+
+    XVector t("t",{Dimension::time,"%Y"},{"2000-01-01","2001-01-01"});
+    CHECK_EQUAL(1, t.offset("2001"));
+    t.dimension.units="%Y-%m";
+    CHECK_EQUAL(1, t.offset("2001-01"));
+  }
 }